@@ -12,6 +12,11 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// Buffers are allocated from a slab cache as blocks are first
+// read, up to one per BUFMEM bytes of RAM; after that the least
+// recently used unused buffer is recycled, or a new one is
+// allocated if every buffer is in use.
 
 
 #include "types.h"
@@ -22,10 +27,16 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "memlayout.h"
+#include "slab.h"
+
+#define BUFMEM (64*PGSIZE)  // bytes of RAM per cached block
 
 struct {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct kmem_cache cache;
+  int n;       // buffers allocated
+  int max;     // buffers to allocate before recycling
 
   // Linked list of all buffers, through prev/next.
   // Sorted by how recently the buffer was used.
@@ -36,20 +47,14 @@ struct {
 void
 binit(void)
 {
-  struct buf *b;
-
   initlock(&bcache.lock, "bcache");
+  kmem_cache_init(&bcache.cache, "buf", sizeof(struct buf));
+  bcache.n = 0;
+  bcache.max = (PHYSTOP - KERNBASE) / BUFMEM;
 
-  // Create linked list of buffers
+  // Empty linked list of buffers
   bcache.head.prev = &bcache.head;
   bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
 }
 
 // Look through buffer cache for block on device dev.
@@ -73,19 +78,34 @@ bget(uint dev, uint blockno)
   }
 
   // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // Recycle the least recently used (LRU) unused buffer
+  // once there are enough of them.
+  if(bcache.n >= bcache.max){
+    for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
+      if(b->refcnt == 0)
+        goto found;
     }
   }
-  panic("bget: no buffers");
+
+  // Allocate a new buffer.
+  if((b = kmem_cache_alloc(&bcache.cache)) == 0)
+    panic("bget: no buffers");
+  initsleeplock(&b->lock, "buffer");
+  b->disk = 0;
+  b->next = bcache.head.next;
+  b->prev = &bcache.head;
+  bcache.head.next->prev = b;
+  bcache.head.next = b;
+  bcache.n++;
+
+found:
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -1,6 +1,7 @@
 //
 // Console input and output, to the uart.
-// Reads are line at a time.
+// Reads are line at a time, unless the console is in raw
+// mode (see consoleioctl()).
 // Implements special input characters:
 //   newline -- end of line
 //   control-h -- backspace
@@ -21,6 +22,7 @@
 #include "riscv.h"
 #include "defs.h"
 #include "proc.h"
+#include "fcntl.h"
 
 #define BACKSPACE 0x100
 #define C(x)  ((x)-'@')  // Control-x
@@ -50,21 +52,23 @@ struct {
   uint r;  // Read index
   uint w;  // Write index
   uint e;  // Edit index
+  int mode; // CONS_RAW, CONS_NOECHO
 } cons;
 
 //
 // user write()s to the console go here.
 //
 int
-consolewrite(int user_src, uint64 src, int n)
+consolewrite(struct file *f, int user_src, uint64 src, int n)
 {
-  int i;
+  char buf[128];
+  int i, m;
 
-  for(i = 0; i < n; i++){
-    char c;
-    if(either_copyin(&c, user_src, src+i, 1) == -1)
+  for(i = 0; i < n; i += m){
+    m = n - i < sizeof(buf) ? n - i : sizeof(buf);
+    if(either_copyin(buf, user_src, src+i, m) == -1)
       break;
-    uartputc(c);
+    uartwrite(buf, m);
   }
 
   return i;
@@ -72,16 +76,22 @@ consolewrite(int user_src, uint64 src, int n)
 
 //
 // user read()s from the console go here.
-// copy (up to) a whole input line to dst.
+// copy (up to) a whole input line to dst, or in raw
+// mode whatever input has arrived, once there is some.
 // user_dist indicates whether dst is a user
 // or kernel address.
 //
 int
-consoleread(int user_dst, uint64 dst, int n)
+consoleread(struct file *f, int user_dst, uint64 dst, int n)
 {
-  uint target;
-  int c;
-  char cbuf;
+  uint target, m, i;
+  int eol;
+  char *s;
+  struct uspan u;
+
+  // fault in dst now; the copies below hold cons.lock.
+  if(uspaninit(&u, user_dst, dst, n, 1) < 0)
+    return -1;
 
   target = n;
   acquire(&cons.lock);
@@ -89,38 +99,53 @@ consoleread(int user_dst, uint64 dst, int n)
     // wait until interrupt handler has put some
     // input into cons.buffer.
     while(cons.r == cons.w){
-      if(killed(myproc())){
+      if(n < target && ((cons.mode & CONS_RAW) || f->nonblock))
+        goto out;
+      if(f->nonblock || killed(myproc())){
         release(&cons.lock);
         return -1;
       }
       sleep(&cons.r, &cons.lock);
     }
 
-    c = cons.buf[cons.r++ % INPUT_BUF_SIZE];
-
-    if(c == C('D')){  // end-of-file
-      if(n < target){
-        // Save ^D for next time, to make sure
-        // caller gets a 0-byte result.
-        cons.r--;
+    // the input up to the end of cons.buf, the end of dst,
+    // and, unless in raw mode, the end of the line.
+    s = &cons.buf[cons.r % INPUT_BUF_SIZE];
+    m = cons.w - cons.r;
+    if(m > INPUT_BUF_SIZE - cons.r % INPUT_BUF_SIZE)
+      m = INPUT_BUF_SIZE - cons.r % INPUT_BUF_SIZE;
+    if(m > n)
+      m = n;
+    eol = 0;
+    for(i = 0; i < m && (cons.mode & CONS_RAW) == 0; i++){
+      if(s[i] == C('D')){  // end-of-file
+        if(i == 0 && n == target){
+          // consume ^D: a 0-byte result. otherwise
+          // save it for next time, to make sure the
+          // caller gets one.
+          cons.r++;
+        }
+        m = i;
+        eol = 1;
+        break;
+      } else if(s[i] == '\n'){
+        // a whole line has arrived, return to
+        // the user-level read().
+        m = i + 1;
+        eol = 1;
+        break;
       }
-      break;
     }
 
-    // copy the input byte to the user-space buffer.
-    cbuf = c;
-    if(either_copyout(user_dst, dst, &cbuf, 1) == -1)
+    // copy the input bytes to the user-space buffer.
+    if(uspanout(&u, s, m) == -1)
       break;
-
-    dst++;
-    --n;
-
-    if(c == '\n'){
-      // a whole line has arrived, return to
-      // the user-level read().
+    cons.r += m;
+    n -= m;
+    if(eol)
       break;
-    }
   }
+ out:
   release(&cons.lock);
 
   return target - n;
@@ -137,6 +162,19 @@ consoleintr(int c)
 {
   acquire(&cons.lock);
 
+  if(cons.mode & CONS_RAW){
+    // no editing: each byte is input as it arrives.
+    if(cons.e-cons.r < INPUT_BUF_SIZE){
+      if((cons.mode & CONS_NOECHO) == 0)
+        consputc(c);
+      cons.buf[cons.e++ % INPUT_BUF_SIZE] = c;
+      cons.w = cons.e;
+      wakeup(&cons.r);
+    }
+    release(&cons.lock);
+    return;
+  }
+
   switch(c){
   case C('P'):  // Print process list.
     procdump();
@@ -145,14 +183,16 @@ consoleintr(int c)
     while(cons.e != cons.w &&
           cons.buf[(cons.e-1) % INPUT_BUF_SIZE] != '\n'){
       cons.e--;
-      consputc(BACKSPACE);
+      if((cons.mode & CONS_NOECHO) == 0)
+        consputc(BACKSPACE);
     }
     break;
   case C('H'): // Backspace
   case '\x7f': // Delete key
     if(cons.e != cons.w){
       cons.e--;
-      consputc(BACKSPACE);
+      if((cons.mode & CONS_NOECHO) == 0)
+        consputc(BACKSPACE);
     }
     break;
   default:
@@ -160,7 +200,8 @@ consoleintr(int c)
       c = (c == '\r') ? '\n' : c;
 
       // echo back to the user.
-      consputc(c);
+      if((cons.mode & CONS_NOECHO) == 0)
+        consputc(c);
 
       // store for consumption by consoleread().
       cons.buf[cons.e++ % INPUT_BUF_SIZE] = c;
@@ -178,6 +219,30 @@ consoleintr(int c)
   release(&cons.lock);
 }
 
+//
+// ioctl()s on the console go here: get or set the mode.
+// raw mode passes every byte on to consoleread() as soon
+// as it arrives, without line editing or end-of-file.
+//
+int
+consoleioctl(struct file *f, int req, int arg)
+{
+  if(req == CONSGETMODE)
+    return cons.mode;
+  if(req != CONSSETMODE || (arg & ~(CONS_RAW|CONS_NOECHO)) != 0)
+    return -1;
+
+  acquire(&cons.lock);
+  cons.mode = arg;
+  if((cons.mode & CONS_RAW) && cons.w != cons.e){
+    // the line being edited can now be read.
+    cons.w = cons.e;
+    wakeup(&cons.r);
+  }
+  release(&cons.lock);
+  return 0;
+}
+
 void
 consoleinit(void)
 {
@@ -189,4 +254,5 @@ consoleinit(void)
   // to consoleread and consolewrite.
   devsw[CONSOLE].read = consoleread;
   devsw[CONSOLE].write = consolewrite;
+  devsw[CONSOLE].ioctl = consoleioctl;
 }
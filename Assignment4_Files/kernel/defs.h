@@ -2,12 +2,14 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct uspan;
 
 // bio.c
 void            binit(void);
@@ -31,19 +33,30 @@ void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
+int             filepread(struct file*, uint64, int n, uint);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filepwrite(struct file*, uint64, int n, uint);
+int             fileallocate(struct file*, uint, uint);
 int             fileseek(struct file *, int, int);
+int             fileioctl(struct file*, int, int);
+int             filevmsplice(struct file*, uint64, int);
+int             filesplice(struct file*, struct file*, int);
 
 // random.c
 void            randominit(void);
 uint8           lfsr_char(uint8 lfsr);
 
 // fs.c
+void            bfreeze(void);
+void            bcommitted(void);
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
-struct inode*   ialloc(uint, short);
+void            dirunlink(struct inode*, char*, uint);
+int             dirhashdue(struct inode*);
+void            dirhashify(struct inode*);
+struct inode*   ialloc(uint, short, uint);
 struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
@@ -57,6 +70,8 @@ struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
+int             writei_direct(struct inode*, uint64, uint, uint, int);
+int             ifallocate(struct inode*, uint, uint, int);
 void            itrunc(struct inode*);
 
 // ramdisk.c
@@ -67,24 +82,38 @@ void            ramdiskrw(struct buf*);
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
+void            kdup(void *);
+int             krefcount(void *);
 void            kinit(void);
 
+// slab.c
+void            kmem_cache_init(struct kmem_cache*, char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            begin_opn(int);
+void            end_opn(int);
+int             log_holds(uint);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, uint64, int, int);
+int             pipewrite(struct pipe*, uint64, int, int);
+int             pipesplice(struct pipe*, struct file*, int);
 
 // printf.c
 void            printf(char*, ...);
 void            panic(char*) __attribute__((noreturn));
 void            printfinit(void);
+void            klogdrain(void);
+int             klogread(uint64, int);
 
 // proc.c
 int             cpuid(void);
@@ -138,6 +167,9 @@ int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// stringtest.c
+void            stringtest(void);
+
 // syscall.c
 void            argint(int, int*);
 int             argstr(int, char*, int);
@@ -157,9 +189,20 @@ void            usertrapret(void);
 void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
+void            uartwrite(char*, int);
 void            uartputc_sync(int);
+int             uarttryput(char*, int);
 int             uartgetc(void);
 
+// vma.c
+void            vmainit(void);
+uint64          vmalow(struct proc*);
+uint64          vmamap(struct proc*, uint64, int, int, struct file*, uint);
+int             vmaunmap(struct proc*, uint64, uint64);
+void            vmaunmapall(struct proc*, pagetable_t, int);
+int             vmacopy(struct proc*, struct proc*);
+int             vmafault(struct proc*, uint64, int);
+
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
@@ -170,6 +213,10 @@ void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmshare(pagetable_t, pagetable_t, uint64, int);
+int             uvmfault(struct proc*, uint64, int);
+char*           uvmlend(struct proc*, uint64);
+int             uvmgive(struct proc*, uint64, char*);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
@@ -178,6 +225,11 @@ uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
+int             uvmtouch(uint64, uint64, int);
+void            utlbflush(struct proc*);
+int             uspaninit(struct uspan*, int, uint64, uint64, int);
+int             uspanout(struct uspan*, void*, uint64);
+int             uspanin(struct uspan*, void*, uint64);
 
 // plic.c
 void            plicinit(void);
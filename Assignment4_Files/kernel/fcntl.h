@@ -3,6 +3,29 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
+#define O_NONBLOCK 0x800
 #define SEEK_SET    0
 #define SEEK_CUR    1
+#define SEEK_END    2
+
+// for mmap()
+#define PROT_READ     0x1
+#define PROT_WRITE    0x2
+#define MAP_SHARED    0x01
+#define MAP_PRIVATE   0x02
+#define MAP_ANONYMOUS 0x20
+
+// for ioctl()
+#define FIONBIO     1   // arg != 0: reads return -1 instead of waiting
+#define CONSGETMODE 2   // console: return the mode
+#define CONSSETMODE 3   // console: set the mode to arg
+#define CONS_RAW    0x1 // pass each byte on as it arrives, unedited
+#define CONS_NOECHO 0x2 // do not echo input
+
+// for readv() and writev()
+#define IOV_MAX     16
+struct iovec {
+  void *iov_base;
+  uint64 iov_len;
+};
 
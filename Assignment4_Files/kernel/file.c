@@ -13,17 +13,25 @@
 #include "stat.h"
 #include "proc.h"
 #include "fcntl.h"
+#include "slab.h"
+
+// max data blocks per regular file write transaction. each is
+// written synchronously while the transaction is open, holding
+// up its commit for every other writer, so keep it small.
+#define WRBLOCKS 64
+#define WRLOG      16  // max of those that may have to be logged
 
 struct devsw devsw[NDEV];
 struct {
-  struct spinlock lock;
-  struct file file[NFILE];
+  struct spinlock lock;       // protects every file's ref
+  struct kmem_cache cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  kmem_cache_init(&ftable.cache, "file", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -32,16 +40,11 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kmem_cache_alloc(&ftable.cache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,12 +72,13 @@ void fileclose(struct file *f)
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
   release(&ftable.lock);
+  kmem_cache_free(&ftable.cache, f);
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
   } else if(ff.type == FD_INODE || ff.type == FD_DEVICE){
+    if(ff.type == FD_DEVICE && devsw[ff.major].close)
+      devsw[ff.major].close(&ff);
     begin_op();
     iput(ff.ip);
     end_op();
@@ -99,6 +103,22 @@ int filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Read n bytes from inode file f at *poff, advancing *poff.
+static int
+inoderead(struct file *f, uint64 addr, int n, uint *poff)
+{
+  int r;
+
+  // fault in addr first: it may be mapped from a file, maybe
+  // this one, and vmafault() locks that file's i-node.
+  uvmtouch(addr, n, 1);
+  ilock(f->ip);
+  if((r = readi(f->ip, 1, addr, *poff, n)) > 0)
+    *poff += r;
+  iunlock(f->ip);
+  return r;
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
@@ -110,16 +130,13 @@ fileread(struct file *f, uint64 addr, int n)
     return -1;
 
   if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
+    r = piperead(f->pipe, addr, n, f->nonblock);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
-    r = devsw[f->major].read(1, addr, n);
+    r = devsw[f->major].read(f, 1, addr, n);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    r = inoderead(f, addr, n, &f->off);
   } else {
     panic("fileread");
   }
@@ -127,90 +144,202 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
+// Read from file f at offset off, leaving f->off alone.
+// Only files with an offset (inodes) can do this.
+int
+filepread(struct file *f, uint64 addr, int n, uint off)
+{
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  return inoderead(f, addr, n, &off);
+}
+
+// Log blocks to reserve for writing (or allocating) n bytes
+// at off in a regular file, with data blocks going straight to
+// disk: the i-node, bitmap blocks, indirect blocks on each
+// level, and *nlog data blocks that the log already holds and
+// that must therefore be logged (see writei_direct()).
+static int
+wrreserve(uint off, int n, int *nlog)
+{
+  int nb = (off % BSIZE + n + BSIZE - 1) / BSIZE;
+
+  *nlog = nb < WRLOG ? nb : WRLOG;
+  return 1 + (nb/BPB + 2) + (nb/NINDIRECT + 6) + *nlog;
+}
+
+// Write n bytes to inode file f at *poff, advancing *poff.
+static int
+inodewrite(struct file *f, uint64 addr, int n, uint *poff)
+{
+  int r, res, nlog;
+
+  // regular files are written up to WRBLOCKS blocks per
+  // transaction, reserving log space with wrreserve().
+  // other inodes (devices, directories) log everything, a
+  // few blocks at a time: the i-node, up to three levels of
+  // indirect blocks, allocation blocks, and 2 blocks of slop
+  // for non-aligned writes.
+  int direct = (f->ip->type == T_FILE);
+  int max = direct ? WRBLOCKS*BSIZE : ((MAXOPBLOCKS-1-3-2) / 2) * BSIZE;
+  int i = 0;
+  while(i < n){
+    int n1 = n - i;
+    if(n1 > max)
+      n1 = max;
+
+    res = direct ? wrreserve(*poff, n1, &nlog) : MAXOPBLOCKS;
+
+    // fault in the source before locking, as inoderead() does.
+    uvmtouch(addr + i, n1, 0);
+
+    begin_opn(res);
+    ilock(f->ip);
+    if(direct)
+      r = writei_direct(f->ip, addr + i, *poff, n1, nlog);
+    else
+      r = writei(f->ip, 1, addr + i, *poff, n1);
+    if(r > 0)
+      *poff += r;
+    iunlock(f->ip);
+    end_opn(res);
+
+    if(r < 0 || (!direct && r != n1)){
+      // error from writei
+      break;
+    }
+    // a direct write may stop early, even before writing
+    // anything, when it runs out of reserved log space.
+    i += r;
+  }
+  return (i == n ? n : -1);
+}
+
 // Write to file f.
 // addr is a user virtual address.
 int
 filewrite(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  int ret = 0;
 
   if(f->writable == 0)
     return -1;
 
   if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
+    ret = pipewrite(f->pipe, addr, n, 0);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
       return -1;
-    ret = devsw[f->major].write(1, addr, n);
+    ret = devsw[f->major].write(f, 1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r != n1){
-        // error from writei
-        break;
-      }
-      i += r;
-    }
-    ret = (i == n ? n : -1);
+    ret = inodewrite(f, addr, n, &f->off);
   } else {
     panic("filewrite");
   }
 
   return ret;
 }
+
+// Write n bytes at user address addr to pipe f, handing
+// whole pages to the pipe rather than copying them.
 int
-fileseek (struct file *f, int offset, int whence )
+filevmsplice(struct file *f, uint64 addr, int n)
 {
-  if (f->type != FD_INODE) {
+  if(f->writable == 0 || f->type != FD_PIPE)
     return -1;
-   }
-  if(whence == SEEK_SET){
-    ilock(f->ip);
-    if (f->off < 0){
-      f->off = 0;
-    }
-    else if (offset > f->ip->size){
-      f->off = f->ip->size;
-    }
-    else{
-      f->off = offset;
-    }
-    iunlock(f->ip);
-  }
-  if(whence == SEEK_CUR){
+  return pipewrite(f->pipe, addr, n, 1);
+}
+
+// Move up to n bytes from regular file in to pipe out
+// without copying them through user memory.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  if(in->readable == 0 || in->type != FD_INODE || in->ip->type != T_FILE)
+    return -1;
+  if(out->writable == 0 || out->type != FD_PIPE)
+    return -1;
+  return pipesplice(out->pipe, in, n);
+}
+
+// Write to file f at offset off, leaving f->off alone.
+int
+filepwrite(struct file *f, uint64 addr, int n, uint off)
+{
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+  return inodewrite(f, addr, n, &off);
+}
+
+// Allocate disk blocks for bytes [off, off+n) of regular file f
+// without writing them or changing its size, so that writes
+// there later need not allocate. Returns 0, or -1 on error.
+int
+fileallocate(struct file *f, uint off, uint n)
+{
+  int r, res, nlog;
+  uint n1;
+
+  if(f->writable == 0 || f->type != FD_INODE || f->ip->type != T_FILE)
+    return -1;
+
+  while(n > 0){
+    n1 = n < WRBLOCKS*BSIZE ? n : WRBLOCKS*BSIZE;
+    res = wrreserve(off, n1, &nlog);
+    begin_opn(res);
     ilock(f->ip);
-    if (f->off + offset < 0 ){
-      f->off = 0;
-      }
-    else if (f->off + offset > f->ip->size){
-      f->off = f->ip->size;
-    }  
-    else{
-      f->off = f->off + offset;
-    }
+    r = ifallocate(f->ip, off, n1, nlog);
     iunlock(f->ip);
+    end_opn(res);
+    if(r < 0)
+      return -1;
+    off += r;
+    n -= r;
   }
   return 0;
 }
 
+// Set the offset of file f relative to the start (SEEK_SET),
+// the current offset (SEEK_CUR) or the end (SEEK_END).
+// The offset may go past the end; writing there leaves a hole.
+// Returns the new offset.
+int
+fileseek(struct file *f, int offset, int whence)
+{
+  int off;
 
+  if(f->type != FD_INODE)
+    return -1;
 
+  ilock(f->ip);
+  if(whence == SEEK_SET)
+    off = offset;
+  else if(whence == SEEK_CUR)
+    off = f->off + offset;
+  else if(whence == SEEK_END)
+    off = f->ip->size + offset;
+  else {
+    iunlock(f->ip);
+    return -1;
+  }
+  if(off < 0)
+    off = 0;
+  f->off = off;
+  iunlock(f->ip);
+
+  return off;
+}
+
+// Apply control request req, with argument arg, to f: FIONBIO
+// for any file, others for the device f refers to.
+int
+fileioctl(struct file *f, int req, int arg)
+{
+  if(req == FIONBIO){
+    f->nonblock = arg != 0;
+    return 0;
+  }
+  if(f->type != FD_DEVICE || f->major < 0 || f->major >= NDEV || !devsw[f->major].ioctl)
+    return -1;
+  return devsw[f->major].ioctl(f, req, arg);
+}
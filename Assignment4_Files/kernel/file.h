@@ -7,6 +7,8 @@ struct file {
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
   short major;       // FD_DEVICE
+  void *priv;        // FD_DEVICE: the driver's state for this open
+  char nonblock;     // O_NONBLOCK: reads do not wait for data
 };
 
 #define major(dev)  ((dev) >> 16 & 0xFFFF)
@@ -18,6 +20,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next; // hash chain in inode cache
+  struct inode *lprev; // LRU list, while ref is 0
+  struct inode *lnext;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,13 +31,28 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+3];
+
+  // extent cache: file blocks [ext_lbn, ext_lbn+ext_len) are
+  // at disk blocks [ext_pbn, ext_pbn+ext_len).
+  uint ext_lbn;
+  uint ext_pbn;
+  uint ext_len;
+
+  // blocks [pa_start, pa_start+pa_len) are reserved for this file.
+  uint pa_start;
+  uint pa_len;
 };
 
 // map major device number to device functions.
+// open, if set, is called when a file on the device is opened,
+// and may set f->priv; close is called when it is last closed.
 struct devsw {
-  int (*read)(int, uint64, int);
-  int (*write)(int, uint64, int);
+  int (*read)(struct file*, int, uint64, int);
+  int (*write)(struct file*, int, uint64, int);
+  int (*ioctl)(struct file*, int, int);
+  int (*open)(struct file*);
+  void (*close)(struct file*);
 };
 
 extern struct devsw devsw[];
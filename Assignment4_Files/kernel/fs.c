@@ -11,6 +11,7 @@
 
 #include "types.h"
 #include "riscv.h"
+#include "memlayout.h"
 #include "defs.h"
 #include "param.h"
 #include "stat.h"
@@ -20,6 +21,7 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "slab.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 // there should be one superblock per disk device, but we run with
@@ -37,6 +39,9 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
+static void freemapinit(int dev);
+static void freeimapinit(int dev);
+
 // Init fs
 void
 fsinit(int dev) {
@@ -44,6 +49,8 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  freemapinit(dev);
+  freeimapinit(dev);
 }
 
 // Zero a block.
@@ -59,34 +66,215 @@ bzero(int dev, int bno)
 }
 
 // Blocks.
+//
+// The allocator keeps an in-memory copy of the free-block
+// bitmap, built once by fsinit(), and searches that a word at
+// a time instead of reading bitmap blocks from block 0 on. A
+// block's bit is set in the copy as soon as the block is
+// allocated or reserved, and cleared once it is free on disk.
+//
+// To keep files contiguous, a data block is allocated right
+// after the file's previous block when possible, and a file
+// that grows reserves the next PREALLOC blocks in the copy,
+// then takes them one at a time. Reservations only exist in
+// memory; they are given back when the file is truncated or
+// its last in-memory reference goes away.
+//
+// A freed block stays in use in the copy until the transaction
+// that freed it commits. Until then a crash would leave the
+// block in its old file, so it must not be given to a file
+// that writes it in place (see writei_direct()). bfree() notes
+// it in pend[run], the running transaction's set; bfreeze()
+// makes that the committing transaction's set when the log
+// freezes it, and bcommitted() frees its blocks after the
+// commit.
+
+#define PREALLOC  16            // blocks reserved ahead for a growing file
+#define BPP       (PGSIZE*8)    // bitmap bits per page
+#define NMAPPAGE  32            // max pages of bitmap copy
 
-// Allocate a zeroed disk block.
-// returns 0 if out of disk space.
-static uint
-balloc(uint dev)
+struct {
+  struct spinlock lock;
+  uint64 *page[NMAPPAGE];
+  uint64 *pend[2][NMAPPAGE];   // blocks freed by uncommitted transactions
+  int npend[2];
+  int run;                     // pend[run] is the running transaction's
+} freemap;
+
+static uint64*
+mapword(uint b)
+{
+  return &freemap.page[b / BPP][(b % BPP) / 64];
+}
+
+static int
+maptest(uint b)
+{
+  return (*mapword(b) >> (b % 64)) & 1;
+}
+
+static void
+mapset(uint b, uint n, int used)
+{
+  for(; n > 0; n--, b++){
+    if(used)
+      *mapword(b) |= 1L << (b % 64);
+    else
+      *mapword(b) &= ~(1L << (b % 64));
+  }
+}
+
+// Copy the on-disk bitmap into freemap.
+static void
+freemapinit(int dev)
 {
-  int b, bi, m;
   struct buf *bp;
+  uint b, npage;
+  int i;
+
+  initlock(&freemap.lock, "freemap");
+  npage = (sb.size + BPP - 1) / BPP;
+  if(npage > NMAPPAGE)
+    panic("freemapinit: disk too big");
+  for(i = 0; i < npage; i++){
+    if((freemap.page[i] = kalloc()) == 0 ||
+       (freemap.pend[0][i] = kalloc()) == 0 ||
+       (freemap.pend[1][i] = kalloc()) == 0)
+      panic("freemapinit: kalloc");
+    memset(freemap.page[i], 0xff, PGSIZE); // past sb.size is never free
+    memset(freemap.pend[0][i], 0, PGSIZE);
+    memset(freemap.pend[1][i], 0, PGSIZE);
+  }
 
   bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
+  for(b = 0; b < sb.size; b++){
+    if(b % BPB == 0){
+      if(bp)
         brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+      bp = bread(dev, BBLOCK(b, sb));
     }
+    if((bp->data[(b % BPB)/8] & (1 << (b % 8))) == 0)
+      mapset(b, 1, 0);
+  }
+  if(bp)
     brelse(bp);
+}
+
+// Find n free blocks in a row in freemap, looking from
+// block goal on and wrapping around.
+// Returns the first, or 0 if there are none.
+// Caller must hold freemap.lock.
+static uint
+mapsearch(uint goal, uint n)
+{
+  uint b, i, seen;
+
+  if(goal >= sb.size)
+    goal = 0;
+  b = goal;
+  for(seen = 0; seen < sb.size; ){
+    if(b % 64 == 0 && *mapword(b) == ~0UL){
+      b += 64;  // a word of used blocks
+      seen += 64;
+    } else {
+      if(!maptest(b)){
+        for(i = 1; i < n && b + i < sb.size; i++)
+          if(maptest(b + i))
+            break;
+        if(i == n)
+          return b;
+      }
+      b++;
+      seen++;
+    }
+    if(b >= sb.size)
+      b = 0;
   }
-  printf("balloc: out of blocks\n");
   return 0;
 }
 
+// Mark block b in use in the on-disk bitmap.
+static void
+bmark(int dev, uint b)
+{
+  struct buf *bp;
+  int bi, m;
+
+  bp = bread(dev, BBLOCK(b, sb));
+  bi = b % BPB;
+  m = 1 << (bi % 8);
+  if(bp->data[bi/8] & m)
+    panic("balloc: block in use");
+  bp->data[bi/8] |= m;
+  log_write(bp);
+  brelse(bp);
+}
+
+// Allocate a zeroed disk block, preferably at goal or soon after.
+// returns 0 if out of disk space.
+static uint
+balloc(uint dev, uint goal)
+{
+  uint b;
+
+  acquire(&freemap.lock);
+  if((b = mapsearch(goal, 1)) != 0)
+    mapset(b, 1, 1);
+  release(&freemap.lock);
+  if(b == 0){
+    printf("balloc: out of blocks\n");
+    return 0;
+  }
+  bmark(dev, b);
+  bzero(dev, b);
+  return b;
+}
+
+// Give back the blocks ip has reserved but not used.
+static void
+bunreserve(struct inode *ip)
+{
+  if(ip->pa_len == 0)
+    return;
+  acquire(&freemap.lock);
+  mapset(ip->pa_start, ip->pa_len, 0);
+  release(&freemap.lock);
+  ip->pa_len = 0;
+}
+
+// Allocate a data block for ip, preferably block goal,
+// taking it from ip's reservation and reserving more if needed.
+// The block is not zeroed; writei() does that as it fills it.
+// Caller must hold ip->lock.
+// returns 0 if out of disk space.
+static uint
+balloc_data(struct inode *ip, uint goal)
+{
+  uint b, n;
+
+  if(ip->pa_len == 0 || (goal && goal != ip->pa_start)){
+    bunreserve(ip);
+    acquire(&freemap.lock);
+    n = PREALLOC;
+    if((b = mapsearch(goal, n)) == 0)
+      b = mapsearch(goal, n = 1);
+    if(b)
+      mapset(b, n, 1);
+    release(&freemap.lock);
+    if(b == 0){
+      printf("balloc: out of blocks\n");
+      return 0;
+    }
+    ip->pa_start = b;
+    ip->pa_len = n;
+  }
+
+  b = ip->pa_start++;
+  ip->pa_len--;
+  bmark(ip->dev, b);
+  return b;
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
@@ -102,6 +290,48 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+
+  // free in freemap once this transaction commits.
+  acquire(&freemap.lock);
+  freemap.pend[freemap.run][b / BPP][(b % BPP) / 64] |= 1L << (b % 64);
+  freemap.npend[freemap.run]++;
+  release(&freemap.lock);
+}
+
+// The log is freezing the running transaction to commit it:
+// blocks freed from now on belong to the next one.
+// Called by the log with no FS system call active.
+void
+bfreeze(void)
+{
+  acquire(&freemap.lock);
+  if(freemap.npend[!freemap.run] != 0)
+    panic("bfreeze");
+  freemap.run = !freemap.run;
+  release(&freemap.lock);
+}
+
+// The frozen transaction has committed: its freed blocks
+// may now be allocated again.
+void
+bcommitted(void)
+{
+  uint64 *pend;
+  int c, i, w;
+
+  acquire(&freemap.lock);
+  c = !freemap.run;
+  for(i = 0; freemap.npend[c] > 0 && i < NMAPPAGE && freemap.page[i]; i++){
+    pend = freemap.pend[c][i];
+    for(w = 0; w < PGSIZE/8; w++){
+      if(pend[w]){
+        freemap.page[i][w] &= ~pend[w];
+        pend[w] = 0;
+      }
+    }
+  }
+  freemap.npend[c] = 0;
+  release(&freemap.lock);
 }
 
 // Inodes.
@@ -115,7 +345,7 @@ bfree(int dev, uint b)
 // sb.inodestart. Each inode has a number, indicating its
 // position on the disk.
 //
-// The kernel keeps a table of in-use inodes in memory
+// The kernel keeps a cache of inodes in memory
 // to provide a place for synchronizing access
 // to inodes used by multiple processes. The in-memory
 // inodes include book-keeping information that is
@@ -129,18 +359,18 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a table entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to a cache entry (open files and
+//   current directories). iget() finds or creates an entry
+//   and increments its ref; iput() decrements ref. An entry
+//   whose ref is zero still holds its inode, and can be
+//   found again by iget(), until it is recycled for another.
 //
 // * Valid: the information (type, size, &c) in an inode
-//   table entry is only correct when ip->valid is 1.
-//   ilock() reads the inode from
-//   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   cache entry is only correct when ip->valid is 1.
+//   ilock() reads the inode from the disk and sets
+//   ip->valid, while iput() clears ip->valid when it
+//   frees the inode on disk.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -164,60 +394,217 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// Entries come from a slab cache as inodes are first used, up
+// to one per INODEMEM bytes of RAM, and are hashed
+// by (dev, inum) into NIHASH buckets. A bucket's spin-lock
+// protects its chain and the ref of every entry on it, so
+// iget() of a cached inode, idup() and iput() lock only one
+// bucket. Entries with ref zero are also kept on an LRU list,
+// protected by itable.lrulock, and once the cache is full
+// iget() recycles the least recently used one when it misses. Recycling moves an entry
+// between buckets, so misses are serialized by itable.lock,
+// the only path that may hold two bucket locks at once.
+//
+// Thus one must hold the bucket lock to use ip->ref, and to
+// change ip->dev or ip->inum, which happens only while ref is 0.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
-struct {
+#define INODEMEM (32*PGSIZE)  // bytes of RAM per cached inode
+
+struct ibucket {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *head;
+};
+
+struct {
+  struct spinlock lock;       // serializes misses
+  struct kmem_cache cache;
+  int n, max;                 // entries allocated, and before recycling
+  struct ibucket bucket[NIHASH];
+  struct spinlock lrulock;
+  struct inode lru;           // head of LRU list; lru.lnext is oldest
 } itable;
 
+static struct ibucket*
+ibucket(uint dev, uint inum)
+{
+  return &itable.bucket[(dev*31 + inum) % NIHASH];
+}
+
+// Put ip at the most recently used end of the LRU list.
+// Caller holds ip's bucket lock.
+static void
+lru_add(struct inode *ip)
+{
+  acquire(&itable.lrulock);
+  ip->lprev = itable.lru.lprev;
+  ip->lnext = &itable.lru;
+  itable.lru.lprev->lnext = ip;
+  itable.lru.lprev = ip;
+  release(&itable.lrulock);
+}
+
+// Caller holds ip's bucket lock.
+static void
+lru_remove(struct inode *ip)
+{
+  acquire(&itable.lrulock);
+  ip->lprev->lnext = ip->lnext;
+  ip->lnext->lprev = ip->lprev;
+  ip->lnext = ip->lprev = 0;
+  release(&itable.lrulock);
+}
+
+static void dcacheinit(void);
+
 void
 iinit()
 {
-  int i = 0;
-  
+  int i;
+
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  kmem_cache_init(&itable.cache, "inode", sizeof(struct inode));
+  itable.n = 0;
+  itable.max = (PHYSTOP - KERNBASE) / INODEMEM;
+  initlock(&itable.lrulock, "itable.lru");
+  for(i = 0; i < NIHASH; i++)
+    initlock(&itable.bucket[i].lock, "itable.bucket");
+  itable.lru.lnext = itable.lru.lprev = &itable.lru;
+  dcacheinit();
 }
 
 static struct inode* iget(uint dev, uint inum);
+static void dcache_purge(struct inode*);
 
-// Allocate an inode on device dev.
-// Mark it as allocated by  giving it type type.
-// Returns an unlocked but allocated and referenced inode,
-// or NULL if there is no free inode.
-struct inode*
-ialloc(uint dev, short type)
+// Like blocks, free inodes are found in an in-memory bitmap
+// built by fsinit() from the inode blocks, with a bit set for
+// every inode whose type is non-zero. ialloc() sets the bit
+// and iput() clears it once the inode is free on disk.
+
+#define NIMAPPAGE 4   // max pages of inode bitmap
+
+struct {
+  struct spinlock lock;
+  uint64 *page[NIMAPPAGE];
+} freeimap;
+
+static uint64*
+imapword(uint inum)
+{
+  return &freeimap.page[inum / BPP][(inum % BPP) / 64];
+}
+
+static void
+imapset(uint inum, int used)
+{
+  if(used)
+    *imapword(inum) |= 1L << (inum % 64);
+  else
+    *imapword(inum) &= ~(1L << (inum % 64));
+}
+
+static void
+freeimapinit(int dev)
 {
-  int inum;
   struct buf *bp;
   struct dinode *dip;
+  uint inum, npage;
+  int i;
+
+  initlock(&freeimap.lock, "freeimap");
+  npage = (sb.ninodes + BPP - 1) / BPP;
+  if(npage > NIMAPPAGE)
+    panic("freeimapinit: too many inodes");
+  for(i = 0; i < npage; i++){
+    if((freeimap.page[i] = kalloc()) == 0)
+      panic("freeimapinit: kalloc");
+    memset(freeimap.page[i], 0xff, PGSIZE);
+  }
 
+  bp = 0;
   for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      log_write(bp);   // mark it allocated on the disk
-      brelse(bp);
-      return iget(dev, inum);
+    if(bp == 0 || inum % IPB == 0){
+      if(bp)
+        brelse(bp);
+      bp = bread(dev, IBLOCK(inum, sb));
     }
+    dip = (struct dinode*)bp->data + inum%IPB;
+    if(dip->type == 0)
+      imapset(inum, 0);
+  }
+  if(bp)
     brelse(bp);
+}
+
+// Find and claim a free inode number, looking from near on
+// and wrapping around. Returns 0 if there is none.
+static uint
+imapalloc(uint near)
+{
+  uint inum, seen;
+
+  if(near == 0 || near >= sb.ninodes)
+    near = 1;
+  acquire(&freeimap.lock);
+  inum = near;
+  for(seen = 0; seen < sb.ninodes; ){
+    if(inum % 64 == 0 && *imapword(inum) == ~0UL){
+      inum += 64;  // a word of inodes in use
+      seen += 64;
+    } else {
+      if(((*imapword(inum) >> (inum % 64)) & 1) == 0){
+        imapset(inum, 1);
+        release(&freeimap.lock);
+        return inum;
+      }
+      inum++;
+      seen++;
+    }
+    if(inum >= sb.ninodes)
+      inum = 1;
   }
-  printf("ialloc: no inodes\n");
+  release(&freeimap.lock);
   return 0;
 }
 
+static void
+imapfree(uint inum)
+{
+  acquire(&freeimap.lock);
+  imapset(inum, 0);
+  release(&freeimap.lock);
+}
+
+// Allocate an inode on device dev, preferably close after
+// inode near (usually the new file's parent directory).
+// Mark it as allocated by  giving it type type.
+// Returns an unlocked but allocated and referenced inode,
+// or NULL if there is no free inode.
+struct inode*
+ialloc(uint dev, short type, uint near)
+{
+  uint inum;
+  struct buf *bp;
+  struct dinode *dip;
+
+  if((inum = imapalloc(near)) == 0){
+    printf("ialloc: no inodes\n");
+    return 0;
+  }
+  bp = bread(dev, IBLOCK(inum, sb));
+  dip = (struct dinode*)bp->data + inum%IPB;
+  if(dip->type != 0)
+    panic("ialloc: inode in use");
+  memset(dip, 0, sizeof(*dip));
+  dip->type = type;
+  log_write(bp);   // mark it allocated on the disk
+  brelse(bp);
+  return iget(dev, inum);
+}
+
 // Copy a modified in-memory inode to disk.
 // Must be called after every change to an ip->xxx field
 // that lives on disk.
@@ -246,33 +633,78 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct ibucket *bk, *vb;
+  struct inode *ip, **pp;
+
+  bk = ibucket(dev, inum);
+  acquire(&bk->lock);
+  for(ip = bk->head; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum)
+      goto found;
+  }
+  release(&bk->lock);
 
+  // Not cached: allocate a new entry, or once there are
+  // enough recycle the least recently used one.
+  // Look again once misses are serialized, in case another
+  // CPU brought the inode in meanwhile.
   acquire(&itable.lock);
-
-  // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  acquire(&bk->lock);
+  for(ip = bk->head; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
       release(&itable.lock);
-      return ip;
+      goto found;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
-
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
+  ip = 0;
+  vb = 0;
+  while(itable.n >= itable.max){
+    acquire(&itable.lrulock);
+    ip = itable.lru.lnext;
+    release(&itable.lrulock);
+    if(ip == &itable.lru){
+      ip = 0;  // all in use
+      break;
+    }
+    vb = ip->inum ? ibucket(ip->dev, ip->inum) : 0;
+    if(vb && vb != bk)
+      acquire(&vb->lock);
+    if(ip->ref == 0)
+      break;
+    // ip was picked up by a hit since we looked; try again.
+    if(vb && vb != bk)
+      release(&vb->lock);
+  }
+  if(ip){
+    lru_remove(ip);
+    if(vb){
+      for(pp = &vb->head; *pp != ip; pp = &(*pp)->next)
+        ;
+      *pp = ip->next;
+      if(vb != bk)
+        release(&vb->lock);
+    }
+  } else {
+    if((ip = kmem_cache_alloc(&itable.cache)) == 0)
+      panic("iget: no inodes");
+    memset(ip, 0, sizeof(*ip));
+    initsleeplock(&ip->lock, "inode");
+    itable.n++;
+  }
   ip->dev = dev;
   ip->inum = inum;
-  ip->ref = 1;
   ip->valid = 0;
+  ip->next = bk->head;
+  bk->head = ip;
+  ip->ref = 1;
+  release(&bk->lock);
   release(&itable.lock);
+  return ip;
 
+found:
+  if(ip->ref++ == 0)
+    lru_remove(ip);
+  release(&bk->lock);
   return ip;
 }
 
@@ -281,9 +713,11 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct ibucket *bk = ibucket(ip->dev, ip->inum);
+
+  acquire(&bk->lock);
   ip->ref++;
-  release(&itable.lock);
+  release(&bk->lock);
   return ip;
 }
 
@@ -310,6 +744,7 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->ext_len = 0;
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -327,7 +762,7 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode table entry can
+// If that was the last reference, the inode cache entry can
 // be recycled.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
@@ -336,7 +771,9 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct ibucket *bk = ibucket(ip->dev, ip->inum);
+
+  acquire(&bk->lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
@@ -345,20 +782,26 @@ iput(struct inode *ip)
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
-    release(&itable.lock);
+    release(&bk->lock);
 
+    if(ip->type == T_DIR)
+      dcache_purge(ip);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
     ip->valid = 0;
+    imapfree(ip->inum);
 
     releasesleep(&ip->lock);
 
-    acquire(&itable.lock);
+    acquire(&bk->lock);
   }
 
-  ip->ref--;
-  release(&itable.lock);
+  if(ip->ref == 1)
+    bunreserve(ip);
+  if(--ip->ref == 0)
+    lru_add(ip);
+  release(&bk->lock);
 }
 
 // Common idiom: unlock, then put.
@@ -374,50 +817,180 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in the single-indirect block ip->addrs[NDIRECT], the
+// next NDINDIRECT in the blocks listed by the double-indirect
+// block ip->addrs[NDIRECT+1], and the next NTINDIRECT through
+// the triple-indirect block ip->addrs[NDIRECT+2].
+//
+// Looking a block up through the indirect blocks costs one
+// bread() per level, so bmap() remembers the run of physically
+// contiguous blocks around the last block it looked up there
+// (the extent cache), and blocks within that run are mapped
+// without reading any indirect block.
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one if alloc is set,
+// and otherwise returns 0: the block is a hole.
 // returns 0 if out of disk space.
 static uint
-bmap(struct inode *ip, uint bn)
+bmap(struct inode *ip, uint bn, int alloc)
 {
-  uint addr, *a;
+  uint addr, *a, span, idx, n;
+  int level;
   struct buf *bp;
 
   if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+    if((addr = ip->addrs[bn]) == 0 && alloc){
+      addr = balloc_data(ip, bn > 0 && ip->addrs[bn-1] ? ip->addrs[bn-1] + 1 : 0);
       if(addr == 0)
         return 0;
       ip->addrs[bn] = addr;
     }
     return addr;
   }
-  bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[NDIRECT] = addr;
-    }
+  if(bn - ip->ext_lbn < ip->ext_len)
+    return ip->ext_pbn + (bn - ip->ext_lbn);
+
+  // Find the indirect block tree that maps bn,
+  // and bn's index within it.
+  n = bn - NDIRECT;
+  if(n < NINDIRECT){
+    level = 1;
+    span = 1;
+  } else if((n -= NINDIRECT) < NDINDIRECT){
+    level = 2;
+    span = NINDIRECT;
+  } else {
+    // a uint offset always ends inside the triple-indirect tree.
+    n -= NDINDIRECT;
+    level = 3;
+    span = NDINDIRECT;
+  }
+
+  // Load the top indirect block, allocating if necessary.
+  // Indirect blocks go after the data blocks reserved so far.
+  if((addr = ip->addrs[NDIRECT+level-1]) == 0){
+    if(!alloc)
+      return 0;
+    addr = balloc(ip->dev, ip->pa_start + ip->pa_len);
+    if(addr == 0)
+      return 0;
+    ip->addrs[NDIRECT+level-1] = addr;
+  }
+
+  // Walk down to the data block, allocating as necessary.
+  for(; level > 0; level--, span /= NINDIRECT){
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
+    idx = (n / span) % NINDIRECT;
+    if((addr = a[idx]) == 0 && alloc){
+      if(level > 1)
+        addr = balloc(ip->dev, ip->pa_start + ip->pa_len);
+      else
+        addr = balloc_data(ip, idx > 0 && a[idx-1] ? a[idx-1] + 1 : 0);
       if(addr){
-        a[bn] = addr;
+        a[idx] = addr;
         log_write(bp);
       }
     }
+    if(level == 1 && addr){
+      // remember the contiguous run starting at bn.
+      ip->ext_lbn = bn;
+      ip->ext_pbn = addr;
+      for(ip->ext_len = 1; idx + ip->ext_len < NINDIRECT; ip->ext_len++)
+        if(a[idx + ip->ext_len] != addr + ip->ext_len)
+          break;
+    }
     brelse(bp);
-    return addr;
+    if(addr == 0)
+      return 0;
+  }
+  return addr;
+}
+
+// Return the first block at or after bn that is allocated in
+// ip, or lim if there is none before lim. A missing indirect
+// block skips its whole span, and an indirect block is scanned
+// for its next entry in use, so a long hole costs a few bread()s
+// per indirect block that exists rather than one per block.
+static uint
+bnext(struct inode *ip, uint bn, uint lim)
+{
+  uint addr, *a, span, idx, n, base, j;
+  int level;
+  struct buf *bp;
+
+  while(bn < lim){
+    if(bn < NDIRECT){
+      if(ip->addrs[bn])
+        return bn;
+      bn++;
+      continue;
+    }
+
+    // as in bmap(): the tree that maps bn, and bn's index in it.
+    n = bn - NDIRECT;
+    base = NDIRECT;
+    if(n < NINDIRECT){
+      level = 1;
+      span = 1;
+    } else if((n -= NINDIRECT) < NDINDIRECT){
+      level = 2;
+      span = NINDIRECT;
+      base += NINDIRECT;
+    } else {
+      n -= NDINDIRECT;
+      level = 3;
+      span = NDINDIRECT;
+      base += NINDIRECT + NDINDIRECT;
+    }
+
+    if((addr = ip->addrs[NDIRECT+level-1]) == 0){
+      bn = base + span*NINDIRECT;
+      continue;
+    }
+    for(; level > 0; level--, span /= NINDIRECT){
+      bp = bread(ip->dev, addr);
+      a = (uint*)bp->data;
+      idx = (n / span) % NINDIRECT;
+      for(j = idx; j < NINDIRECT && a[j] == 0; j++)
+        ;
+      addr = j < NINDIRECT ? a[j] : 0;
+      brelse(bp);
+      if(j != idx){
+        // entries idx..j-1 map nothing: go on from entry j.
+        bn = base + n - n % (span*NINDIRECT) + j*span;
+        break;
+      }
+    }
+    if(level == 0)
+      return bn;
   }
+  return lim;
+}
+
+// Free the indirect block addr, which is at the given level
+// (1 for a single-indirect block), and all blocks it maps.
+static void
+itrunc_indirect(uint dev, uint addr, int level)
+{
+  int j;
+  struct buf *bp;
+  uint *a;
 
-  panic("bmap: out of range");
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(level > 1)
+      itrunc_indirect(dev, a[j], level-1);
+    else
+      bfree(dev, a[j]);
+  }
+  brelse(bp);
+  bfree(dev, addr);
 }
 
 // Truncate inode (discard contents).
@@ -425,9 +998,7 @@ bmap(struct inode *ip, uint bn)
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -436,18 +1007,15 @@ itrunc(struct inode *ip)
     }
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  for(i = 0; i < 3; i++){
+    if(ip->addrs[NDIRECT+i]){
+      itrunc_indirect(ip->dev, ip->addrs[NDIRECT+i], i+1);
+      ip->addrs[NDIRECT+i] = 0;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
 
+  bunreserve(ip);
+  ip->ext_len = 0;
   ip->size = 0;
   iupdate(ip);
 }
@@ -464,6 +1032,8 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+static char zeroblock[BSIZE];
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -480,11 +1050,17 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    uint addr = bmap(ip, off/BSIZE);
-    if(addr == 0)
-      break;
-    bp = bread(ip->dev, addr);
+    uint addr = bmap(ip, off/BSIZE, 0);
     m = min(n - tot, BSIZE - off%BSIZE);
+    if(addr == 0){
+      // a hole reads as zeros
+      if(either_copyout(user_dst, dst, zeroblock, m) == -1) {
+        tot = -1;
+        break;
+      }
+      continue;
+    }
+    bp = bread(ip->dev, addr);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
       brelse(bp);
       tot = -1;
@@ -495,6 +1071,98 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
+// Write data to inode, logging data blocks unless direct:
+// then they are bwrite()n in place, and only blocks the log
+// already holds are logged, at most maxlog of them.
+// Blocks past the end of the file may have been allocated
+// without being zeroed (see balloc_data() and ifallocate()),
+// so zero what the write does not cover, including such blocks
+// in the hole that a write past the end leaves.
+// Returns the number of bytes written, which in direct mode may
+// be 0 if maxlog ran out, or -1 if nothing could be written.
+static int
+iwrite(struct inode *ip, int user_src, uint64 src, uint off, uint n,
+       int direct, int maxlog)
+{
+  uint tot, m, b, addr, nblocks, oldsize, oldaddrs[NDIRECT+3];
+  struct buf *bp;
+  int fresh, logged, err;
+
+  if(off + n < off)
+    return -1;
+
+  oldsize = ip->size;
+  nblocks = (ip->size + BSIZE - 1) / BSIZE;
+  memmove(oldaddrs, ip->addrs, sizeof(oldaddrs));
+  tot = 0;
+  err = 0;
+
+  for(b = bnext(ip, nblocks, off/BSIZE); b < off/BSIZE && n > 0;
+      b = bnext(ip, b+1, off/BSIZE)){
+    if((addr = bmap(ip, b, 0)) == 0)
+      continue;
+    logged = !direct || log_holds(addr);
+    if(direct && logged && maxlog-- == 0){
+      // blocks before b are zeroed; the next call goes on.
+      ip->size = b*BSIZE;
+      goto out;
+    }
+    bp = bread(ip->dev, addr);
+    memset(bp->data, 0, BSIZE);
+    if(logged)
+      log_write(bp);
+    else
+      bwrite(bp);
+    brelse(bp);
+  }
+
+  for(; tot<n; tot+=m, off+=m, src+=m){
+    fresh = (off/BSIZE >= nblocks);
+    if((addr = bmap(ip, off/BSIZE, 0)) == 0){
+      // the new block may be one the log holds, so stop now
+      // if it could not be logged: once allocated it is part
+      // of the file, and must not be left unzeroed.
+      if(direct && maxlog == 0)
+        break;
+      if((addr = bmap(ip, off/BSIZE, 1)) == 0){
+        err = 1;
+        break;
+      }
+      fresh = 1;
+    }
+    logged = !direct || log_holds(addr);
+    if(direct && logged && maxlog-- == 0)
+      break;
+    bp = bread(ip->dev, addr);
+    if(fresh)
+      memset(bp->data, 0, BSIZE);
+    m = min(n - tot, BSIZE - off%BSIZE);
+    if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
+      brelse(bp);
+      err = 1;
+      break;
+    }
+    if(logged)
+      log_write(bp);
+    else
+      bwrite(bp);
+    brelse(bp);
+  }
+
+  if(tot > 0 && off > ip->size)
+    ip->size = off;
+  else if(tot == 0 && direct && !err && off/BSIZE > nblocks)
+    ip->size = (off/BSIZE)*BSIZE;  // keep the zeroing done above
+
+out:
+  // write the i-node back to disk if the size changed or
+  // bmap() added a block to ip->addrs[].
+  if(ip->size != oldsize || memcmp(oldaddrs, ip->addrs, sizeof(oldaddrs)) != 0)
+    iupdate(ip);
+
+  return (tot == 0 && err) ? -1 : tot;
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -505,40 +1173,114 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
-  uint tot, m;
+  return iwrite(ip, user_src, src, off, n, 0, 0);
+}
+
+// Write user data to a regular file without logging the data,
+// for filewrite(). The caller's transaction need only have room
+// for the metadata plus maxlog data blocks; the write stops
+// early rather than log more than that, so it may return less
+// than n even without an error.
+// Caller must hold ip->lock.
+int
+writei_direct(struct inode *ip, uint64 src, uint off, uint n, int maxlog)
+{
+  return iwrite(ip, 1, src, off, n, 1, maxlog);
+}
+
+// Allocate disk blocks for the holes in bytes [off, off+n) of ip,
+// without changing its size, for fallocate(). Blocks past the
+// end of the file are not written; iwrite() zeroes them when
+// they become part of the file. Holes inside the file must
+// still read as zeros, so those blocks are zeroed in place,
+// or logged if the log holds them, at most maxlog of them.
+// Returns the number of bytes covered, which may be less than n
+// if maxlog ran out, or -1 if out of disk space.
+// Caller must hold ip->lock.
+int
+ifallocate(struct inode *ip, uint off, uint n, int maxlog)
+{
+  uint b, addr, nblocks;
   struct buf *bp;
+  int logged, err = 0;
 
-  if(off > ip->size || off + n < off)
-    return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if(n == 0)
+    return 0;
+  if(off + n < off)
     return -1;
 
-  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    uint addr = bmap(ip, off/BSIZE);
-    if(addr == 0)
+  nblocks = (ip->size + BSIZE - 1) / BSIZE;
+  for(b = off/BSIZE; b <= (off+n-1)/BSIZE; b++){
+    if(bmap(ip, b, 0) != 0)
+      continue;
+    if(b < nblocks && maxlog == 0)
       break;
-    bp = bread(ip->dev, addr);
-    m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
-      brelse(bp);
+    if((addr = bmap(ip, b, 1)) == 0){
+      err = 1;
       break;
     }
-    log_write(bp);
-    brelse(bp);
+    if(b < nblocks){
+      logged = log_holds(addr);
+      bp = bread(ip->dev, addr);
+      memset(bp->data, 0, BSIZE);
+      if(logged){
+        log_write(bp);
+        maxlog--;
+      } else
+        bwrite(bp);
+      brelse(bp);
+    }
   }
-
-  if(off > ip->size)
-    ip->size = off;
-
-  // write the i-node back to disk even if the size didn't change
-  // because the loop above might have called bmap() and added a new
-  // block to ip->addrs[].
   iupdate(ip);
 
-  return tot;
+  if(b > (off+n-1)/BSIZE)
+    return n;
+  if(b*BSIZE <= off)
+    return err ? -1 : 0;
+  return b*BSIZE - off;
 }
 
 // Directories
+//
+// A directory is a file containing a sequence of dirent
+// structures, which dirlookup() normally scans from the start.
+// A directory whose major number is non-zero is hashed instead
+// (see fs.h). mkfs -h builds such a root, and dirhashify()
+// converts a directory that grows to DIRHASHMIN blocks.
+//
+// The dcache remembers recent lookups, both hits and misses,
+// keyed by (dev, directory inum, name). It is direct-mapped:
+// a new entry simply replaces whatever hashed to the same slot.
+// Entries change only with the directory locked, in dirlookup(),
+// dirlink() and dirunlink(), and all entries for a directory are
+// dropped when it is freed, since its inum may be reused.
+
+#define DIRHASHMIN (PGSIZE/BSIZE - 1)  // blocks at which a directory is hashed
+#define NDIRBUCKET 32                  // buckets it gets
+#define DPB        (BSIZE / sizeof(struct dirent))
+
+// blocks that converting it may log: the buckets, overflow for
+// a page of entries, the i-node, an indirect block and bitmap blocks.
+#define DIRHASHOP  (NDIRBUCKET + PGSIZE/BSIZE + 4)
+
+struct dentry {
+  uint dev;
+  uint dir;            // inum of directory; 0 if slot unused
+  uint inum;           // 0 if name is known to be absent
+  uint off;            // byte offset of entry in directory
+  char name[DIRSIZ];
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry ent[NDENTRY];
+} dcache;
+
+static void
+dcacheinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
 
 int
 namecmp(const char *s, const char *t)
@@ -546,32 +1288,109 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+static struct dentry*
+dslot(struct inode *dp, char *name)
+{
+  return &dcache.ent[(dirhash(name) ^ dp->inum*31 ^ dp->dev) % NDENTRY];
+}
+
+// Look name up in the dcache. Returns 1 and sets *pinum
+// (0 for a known miss) and *poff if the cache knows the answer.
+static int
+dcache_lookup(struct inode *dp, char *name, uint *pinum, uint *poff)
+{
+  struct dentry *d;
+  int found = 0;
+
+  acquire(&dcache.lock);
+  d = dslot(dp, name);
+  if(d->dir == dp->inum && d->dev == dp->dev && namecmp(d->name, name) == 0){
+    *pinum = d->inum;
+    *poff = d->off;
+    found = 1;
+  }
+  release(&dcache.lock);
+  return found;
+}
+
+static void
+dcache_enter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  d = dslot(dp, name);
+  d->dev = dp->dev;
+  d->dir = dp->inum;
+  d->inum = inum;
+  d->off = off;
+  strncpy(d->name, name, DIRSIZ);
+  release(&dcache.lock);
+}
+
+// Drop every entry for directory dp.
+static void
+dcache_purge(struct inode *dp)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.ent; d < &dcache.ent[NDENTRY]; d++)
+    if(d->dir == dp->inum && d->dev == dp->dev)
+      d->dir = 0;
+  release(&dcache.lock);
+}
+
+// Scan the entries of dp in [off, end) for name, or for an
+// empty slot if name is 0. Returns the offset, or -1.
+static int
+dirscan(struct inode *dp, char *name, uint off, uint end, uint *pinum)
+{
+  struct dirent de;
+
+  for(; off < end; off += sizeof(de)){
+    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+      panic("dirscan read");
+    if(name == 0 ? de.inum == 0 : de.inum != 0 && namecmp(name, de.name) == 0){
+      if(pinum)
+        *pinum = de.inum;
+      return off;
+    }
+  }
+  return -1;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
-  struct dirent de;
+  uint inum, off, b;
+  int r;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+  if(dcache_lookup(dp, name, &inum, &off) == 0){
+    if(dp->major > 0){
+      b = dirhash(name) % dp->major;
+      r = dirscan(dp, name, b*BSIZE, (b+1)*BSIZE, &inum);
+      if(r < 0)
+        r = dirscan(dp, name, dp->major*BSIZE, dp->size, &inum);
+    } else {
+      r = dirscan(dp, name, 0, dp->size, &inum);
     }
+    if(r < 0)
+      inum = 0;
+    off = r;
+    dcache_enter(dp, name, inum, off);
   }
 
-  return 0;
+  if(inum == 0)
+    return 0;
+  if(poff)
+    *poff = off;
+  return iget(dp->dev, inum);
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
@@ -580,6 +1399,7 @@ int
 dirlink(struct inode *dp, char *name, uint inum)
 {
   int off;
+  uint b;
   struct dirent de;
   struct inode *ip;
 
@@ -589,22 +1409,118 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  // Look for an empty dirent, in the name's bucket first
+  // if the directory is hashed.
+  if(dp->major > 0){
+    b = dirhash(name) % dp->major;
+    off = dirscan(dp, 0, b*BSIZE, (b+1)*BSIZE, 0);
+    if(off < 0)
+      off = dirscan(dp, 0, dp->major*BSIZE, dp->size, 0);
+  } else {
+    off = dirscan(dp, 0, 0, dp->size, 0);
   }
+  if(off < 0)
+    off = dp->size;
 
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     return -1;
+  dcache_enter(dp, name, inum, off);
 
   return 0;
 }
 
+// Should dp, which is locked, be converted to a hashed directory?
+// Only one that still fits in a page is, since dirhashify() keeps
+// its entries in one meanwhile.
+int
+dirhashdue(struct inode *dp)
+{
+  return dp->type == T_DIR && dp->major == 0 &&
+         dp->size >= DIRHASHMIN*BSIZE && dp->size <= PGSIZE;
+}
+
+// Convert dp to a hashed directory if dirhashdue(). That rewrites
+// every block of it, more than the transaction that added the
+// entry has room for, so it runs in a transaction of its own:
+// call it with none open and dp unlocked. Drops the caller's
+// reference to dp.
+void
+dirhashify(struct inode *dp)
+{
+  struct dirent *de, *end;
+  char *page;
+  uint size, off, over, nb, m, b;
+  ushort used[NDIRBUCKET];
+
+  begin_opn(DIRHASHOP);
+  ilock(dp);
+  if(!dirhashdue(dp) || (page = kalloc()) == 0)
+    goto out;
+  size = dp->size;
+  if(readi(dp, 0, (uint64)page, 0, size) != size)
+    panic("dirhashify: readi");
+  end = (struct dirent*)(page + size);
+
+  // count the entries that will not fit in their buckets.
+  memset(used, 0, sizeof(used));
+  over = 0;
+  for(de = (struct dirent*)page; de < end; de++)
+    if(de->inum && used[dirhash(de->name) % NDIRBUCKET]++ >= DPB)
+      over++;
+  nb = NDIRBUCKET + (over + DPB - 1) / DPB;
+
+  // allocate the new blocks first. if the disk is full, dp is
+  // left unhashed, with some more free slots.
+  for(off = size; off < nb*BSIZE; off += m){
+    m = BSIZE - off % BSIZE;
+    if(writei(dp, 0, (uint64)zeroblock, off, m) != m)
+      goto free;
+  }
+
+  // from here on writei() allocates nothing, and cannot fail.
+  for(off = 0; off < size; off += m){
+    m = min(size - off, BSIZE);
+    writei(dp, 0, (uint64)zeroblock, off, m);
+  }
+  dp->major = NDIRBUCKET;
+  memset(used, 0, sizeof(used));
+  over = NDIRBUCKET*BSIZE;
+  for(de = (struct dirent*)page; de < end; de++){
+    if(de->inum == 0)
+      continue;
+    b = dirhash(de->name) % NDIRBUCKET;
+    if(used[b] < DPB){
+      off = b*BSIZE + used[b]++ * sizeof(*de);
+    } else {
+      off = over;
+      over += sizeof(*de);
+    }
+    writei(dp, 0, (uint64)de, off, sizeof(*de));
+  }
+  iupdate(dp);
+  dcache_purge(dp);  // the entries have moved
+
+ free:
+  kfree(page);
+ out:
+  iunlockput(dp);
+  end_opn(DIRHASHOP);
+}
+
+// Remove the entry for name, found at offset off by dirlookup().
+void
+dirunlink(struct inode *dp, char *name, uint off)
+{
+  struct dirent de;
+
+  memset(&de, 0, sizeof(de));
+  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+    panic("dirunlink: writei");
+  dcache_enter(dp, name, 0, 0);
+}
+
 // Paths
 
 // Copy the next path element from path into name.
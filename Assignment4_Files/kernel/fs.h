@@ -24,18 +24,20 @@ struct superblock {
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+#define NDIRECT 10
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define NTINDIRECT (NDINDIRECT * NINDIRECT)
+#define MAXFILE ((uint64)NDIRECT + NINDIRECT + NDINDIRECT + NTINDIRECT)
 
 // On-disk inode structure
 struct dinode {
   short type;           // File type
-  short major;          // Major device number (T_DEVICE only)
+  short major;          // Major device number (T_DEVICE); buckets (T_DIR)
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+3];   // Data block addresses
 };
 
 // Inodes per block.
@@ -58,3 +60,20 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// A directory whose major number is non-zero is hashed: major is
+// its number of buckets. Block b of it holds the entries whose
+// names hash to b modulo major, and entries that did not fit in
+// their bucket follow the buckets.
+
+// FNV-1a over a directory entry name.
+static inline uint
+dirhash(const char *name)
+{
+  uint h = 2166136261;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
@@ -1,6 +1,16 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// Each CPU keeps its own free list, so that CPUs rarely
+// contend for a lock. A CPU whose list runs dry takes a
+// batch of pages from a global pool, or steals half of
+// another CPU's list; one whose list grows too long gives
+// a batch back to the pool.
+//
+// Pages are only filled with junk, to catch dangling
+// references, when the kernel is built with KDEBUG.
+// Callers that need zeroed pages clear them themselves.
 
 #include "types.h"
 #include "param.h"
@@ -9,6 +19,9 @@
 #include "riscv.h"
 #include "defs.h"
 
+#define KBATCH 32           // pages moved to or from the pool at once
+#define KCPUMAX (2*KBATCH)  // most pages a CPU's list keeps
+
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
@@ -18,15 +31,32 @@ struct run {
   struct run *next;
 };
 
-struct {
+struct freelist {
   struct spinlock lock;
-  struct run *freelist;
+  struct run *head;
+  int n;
+};
+
+struct {
+  struct freelist pool;
+  struct freelist cpu[NCPU];
 } kmem;
 
+// Number of page-table entries that refer to each page,
+// so that fork can share pages copy-on-write.
+// Updated with atomic instructions rather than a lock.
+int krefs[(PHYSTOP - KERNBASE) / PGSIZE];
+
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
+  int i;
+
+  initlock(&kmem.pool.lock, "kmem");
+  for(i = 0; i < NCPU; i++)
+    initlock(&kmem.cpu[i].lock, "kmem cpu");
   freerange(end, (void*)PHYSTOP);
 }
 
@@ -35,31 +65,107 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    krefs[PA2REF(p)] = 1;
     kfree(p);
+  }
+}
+
+// Add a reference to the allocated page pa.
+void
+kdup(void *pa)
+{
+  if(__sync_fetch_and_add(&krefs[PA2REF(pa)], 1) < 1)
+    panic("kdup");
 }
 
-// Free the page of physical memory pointed at by pa,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// The number of references to the allocated page pa.
+int
+krefcount(void *pa)
+{
+  return krefs[PA2REF(pa)];
+}
+
+// Move up to n pages from the front of list from to list to.
+// The caller holds the locks. Returns the number moved.
+static int
+kmove(struct freelist *from, struct freelist *to, int n)
+{
+  struct run *first, *last;
+  int i;
+
+  if((first = from->head) == 0 || n <= 0)
+    return 0;
+  last = first;
+  for(i = 1; i < n && last->next; i++)
+    last = last->next;
+  from->head = last->next;
+  from->n -= i;
+  last->next = to->head;
+  to->head = first;
+  to->n += i;
+  return i;
+}
+
+// Take half of the pages of the CPU with the longest
+// list other than id into *fl. Only one lock is held
+// at a time, so two stealing CPUs cannot deadlock.
+static void
+ksteal(int id, struct freelist *fl)
+{
+  struct freelist *victim = 0;
+  int i;
+
+  for(i = 0; i < NCPU; i++)
+    if(i != id && (victim == 0 || kmem.cpu[i].n > victim->n))
+      victim = &kmem.cpu[i];
+  if(victim == 0 || victim->n == 0)
+    return;
+  acquire(&victim->lock);
+  kmove(victim, fl, (victim->n + 1) / 2);
+  release(&victim->lock);
+}
+
+// Drop a reference to the page of physical memory pointed
+// at by pa, which normally should have been returned by a
+// call to kalloc(), and free it if that was the last one.
+// (The exception is when initializing the allocator; see
+// kinit above.)
 void
 kfree(void *pa)
 {
   struct run *r;
+  struct freelist *fl;
+  int n;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  if((n = __sync_sub_and_fetch(&krefs[PA2REF(pa)], 1)) < 0)
+    panic("kfree: ref");
+  if(n > 0)
+    return;
+
+#ifdef KDEBUG
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  fl = &kmem.cpu[cpuid()];
+  acquire(&fl->lock);
+  r->next = fl->head;
+  fl->head = r;
+  fl->n++;
+  if(fl->n > KCPUMAX){
+    acquire(&kmem.pool.lock);
+    kmove(fl, &kmem.pool, KBATCH);
+    release(&kmem.pool.lock);
+  }
+  release(&fl->lock);
+  pop_off();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -69,14 +175,39 @@ void *
 kalloc(void)
 {
   struct run *r;
+  struct freelist *fl, stolen;
+  int id;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  push_off();
+  id = cpuid();
+  fl = &kmem.cpu[id];
+  acquire(&fl->lock);
+  if(fl->head == 0){
+    acquire(&kmem.pool.lock);
+    kmove(&kmem.pool, fl, KBATCH);
+    release(&kmem.pool.lock);
+  }
+  if(fl->head == 0){
+    release(&fl->lock);
+    stolen.head = 0;
+    stolen.n = 0;
+    ksteal(id, &stolen);
+    acquire(&fl->lock);
+    kmove(&stolen, fl, stolen.n);
+  }
+  r = fl->head;
+  if(r){
+    fl->head = r->next;
+    fl->n--;
+  }
+  release(&fl->lock);
+  pop_off();
 
-  if(r)
+  if(r){
+    krefs[PA2REF(r)] = 1;
+#ifdef KDEBUG
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+  }
   return (void*)r;
 }
@@ -10,41 +10,106 @@
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
+// calls. A transaction is only committed when there are no FS
+// system calls active in it. Thus there is never
 // any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
+// The log is double-buffered (group commit). While commit()
+// writes one transaction to disk, the next transaction is
+// already open and collects new FS system calls, which are
+// then committed together. To make that safe, commit() first
+// freezes the transaction: with no system call active, it
+// copies each logged block into a private buffer of the log,
+// and writes those frozen copies out while the next
+// transaction goes on modifying the cached blocks.
+//
 // A system call should call begin_op()/end_op() to mark
 // its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// the count of in-progress FS system calls, reserves log
+// space for MAXOPBLOCKS blocks, and returns; a call that may
+// log more or fewer blocks uses begin_opn()/end_opn() instead.
+// But if it thinks the running transaction is close to
+// running out of log space, or that the transaction has been
+// open for too long (see LOGDELAY), it sleeps until the last
+// outstanding end_op() lets it be committed.
 //
-// The log is a physical re-do log containing disk blocks.
-// The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
+// The log is a circular physical re-do log containing disk
+// blocks. Each committed transaction is appended as
+//   header block, containing a sequence number, block #s for
+//     block A, B, C, ..., and a checksum over all of it
 //   block A
 //   block B
 //   block C
 //   ...
+// A transaction is committed once all of these are on disk;
+// recovery tells a complete transaction from a torn one by
+// its checksum, so the header is written only once.
+//
+// Blocks are not installed at their home locations at commit.
+// The log keeps the latest committed copy of each logged block
+// (and the block pinned in the cache) until a checkpoint, which
+// writes every such block home once, however many transactions
+// rewrote it, and then records in the log's super block (the
+// first block of the log) where the live part of the log now
+// starts. A checkpoint happens when the log or the set of
+// blocks awaiting it is about to run out of room.
 // Log appends are synchronous.
 
-// Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged block# before commit.
+// A transaction that is busy is closed to new FS system calls
+// once it is this many ticks old, so that it gets committed.
+// The deadline is best-effort: the system calls already in the
+// transaction must still finish, and the last one's end_op()
+// commits it, so a long-running call delays the commit (and,
+// since the transaction is closed, everyone's next begin_op())
+// until it is done. A transaction cannot be committed any
+// sooner, as that would write a half-done call's updates.
+#define LOGDELAY 5
+
+#define LOGMAGIC 0x4c4f4721
+
+// Contents of a transaction's header block, used for both the
+// on-disk header block and to keep track in memory of logged
+// block# before commit.
 struct logheader {
+  uint magic;  // LOGMAGIC
+  uint seq;    // sequence number of the transaction
+  uint cksum;  // checksum over header and blocks, with cksum = 0
   int n;
   int block[LOGSIZE];
 };
 
+// Contents of the log's super block, only written by checkpoints.
+struct logsuper {
+  uint magic;  // LOGMAGIC
+  uint seq;    // sequence number of the first live transaction
+  uint tail;   // block # of the first live transaction's header
+};
+
 struct log {
   struct spinlock lock;
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks they have reserved.
+  int committing;  // in commit(), the next commit must wait.
+  int freezing;    // in freeze(), please wait.
+  uint opened;     // ticks when the running transaction logged its first block.
   int dev;
-  struct logheader lh;
+  struct logheader lh;  // running transaction
+  struct logheader clh; // committing transaction
+
+  // Owned by the committing process.
+  uint seq;        // sequence number of the next transaction
+  uint head;       // where the next transaction goes
+  uint used;       // log blocks used since the last checkpoint
+  int cidx[LOGSIZE];            // clh.block[i] is in ck[cidx[i]]
+  int nck;
+  struct buf ck[NCKPT];         // latest committed copy of blocks awaiting checkpoint
+  uint ckblock[NCKPT];          // home block # of ck[i]; ck[i].blockno is
+                                // pointed at log blocks to write it there
+  struct buf *cached[NCKPT];    // the cache blocks they keep pinned
+  struct buf hbuf;              // for writing headers
 };
 struct log log;
 
@@ -54,87 +119,172 @@ static void commit();
 void
 initlog(int dev, struct superblock *sb)
 {
+  int i;
+
   if (sizeof(struct logheader) >= BSIZE)
     panic("initlog: too big logheader");
+  if (sb->nlog < 2*(LOGSIZE+1)+1)
+    panic("initlog: log too small");
 
   initlock(&log.lock, "log");
+  for (i = 0; i < NCKPT; i++) {
+    initsleeplock(&log.ck[i].lock, "logbuf");
+    log.ck[i].dev = dev;
+  }
+  initsleeplock(&log.hbuf.lock, "loghead");
+  log.hbuf.dev = dev;
   log.start = sb->logstart;
   log.size = sb->nlog;
   log.dev = dev;
   recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
-static void
-install_trans(int recovering)
+// Checksum n bytes at p, continuing from sum.
+static uint
+cksum(uint sum, void *p, int n)
 {
-  int tail;
+  uchar *c = p;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
-  }
+  while(n-- > 0)
+    sum = (sum ^ *c++) * 16777619;
+  return sum;
 }
 
-// Read the log header from disk into the in-memory log header
-static void
-read_head(void)
+// Checksum the header h and its blocks; data(i) gives block i.
+static uint
+trans_cksum(struct logheader *h, uchar *(*data)(int))
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
+  uint sum, saved;
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
-  }
-  brelse(buf);
+
+  saved = h->cksum;
+  h->cksum = 0;
+  sum = cksum(2166136261, h, sizeof(*h));
+  h->cksum = saved;
+  for (i = 0; i < h->n; i++)
+    sum = cksum(sum, data(i), BSIZE);
+  return sum;
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
 static void
-write_head(void)
+write_super(uint seq, uint tail)
 {
   struct buf *buf = bread(log.dev, log.start);
-  struct logheader *hb = (struct logheader *) (buf->data);
-  int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
-  }
+  struct logsuper *ls = (struct logsuper *) (buf->data);
+
+  ls->magic = LOGMAGIC;
+  ls->seq = seq;
+  ls->tail = tail;
   bwrite(buf);
   brelse(buf);
 }
 
+// During recovery, the log blocks of the transaction in clh
+// are cached in ck[].
+static uchar*
+recovered_data(int i)
+{
+  return log.ck[i].data;
+}
+
+// Read the transaction header at pos into clh, and its blocks
+// into ck[]. Return 1 if it is the complete transaction seq.
+static int
+read_trans(uint pos, uint seq)
+{
+  struct buf *bp;
+  int i;
+
+  if (pos + 1 > log.start + log.size)
+    return 0;
+  bp = bread(log.dev, pos);
+  memmove(&log.clh, bp->data, sizeof(log.clh));
+  brelse(bp);
+  if (log.clh.magic != LOGMAGIC || log.clh.seq != seq ||
+     log.clh.n < 1 || log.clh.n > LOGSIZE ||
+     pos + 1 + log.clh.n > log.start + log.size)
+    return 0;
+  for (i = 0; i < log.clh.n; i++) {
+    bp = bread(log.dev, pos + 1 + i);
+    memmove(log.ck[i].data, bp->data, BSIZE);
+    brelse(bp);
+  }
+  return trans_cksum(&log.clh, recovered_data) == log.clh.cksum;
+}
+
+// Replay every complete transaction after the last checkpoint,
+// in order, then start a new, empty log after them.
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  struct buf *bp;
+  struct logsuper ls;
+  uint pos, seq;
+  int i;
+
+  bp = bread(log.dev, log.start);
+  memmove(&ls, bp->data, sizeof(ls));
+  brelse(bp);
+  if (ls.magic != LOGMAGIC) {  // fresh file system
+    ls.seq = 1;
+    ls.tail = log.start + 1;
+  }
+
+  pos = ls.tail;
+  seq = ls.seq;
+  while (1) {
+    if (!read_trans(pos, seq)) {
+      // the transaction may have wrapped around.
+      if (pos == log.start + 1 || !read_trans(log.start + 1, seq))
+        break;
+      pos = log.start + 1;
+    }
+    for (i = 0; i < log.clh.n; i++) {
+      bp = bread(log.dev, log.clh.block[i]);
+      memmove(bp->data, log.ck[i].data, BSIZE);
+      bwrite(bp);  // install at home location
+      brelse(bp);
+    }
+    pos += 1 + log.clh.n;
+    seq++;
+  }
+
+  log.seq = seq;
+  log.head = pos;
+  log.used = 0;
+  log.nck = 0;
+  write_super(seq, pos);
 }
 
 // called at the start of each FS system call.
 void
 begin_op(void)
 {
+  begin_opn(MAXOPBLOCKS);
+}
+
+// called at the start of an FS system call that
+// logs at most n blocks.
+void
+begin_opn(int n)
+{
+  if(n > LOGSIZE)
+    panic("begin_opn");
+
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.freezing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.reserved + n > LOGSIZE){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
+    } else if(log.outstanding > 0 && log.lh.n > 0 &&
+              ticks - log.opened >= LOGDELAY){
+      // the running transaction is old; let it drain and commit.
+      sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
       release(&log.lock);
       break;
     }
@@ -142,17 +292,28 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation,
+// unless a commit is already in progress; that commit
+// then picks up the running transaction when it is done.
 void
 end_op(void)
+{
+  end_opn(MAXOPBLOCKS);
+}
+
+// called at the end of an FS system call
+// that started with begin_opn(n).
+void
+end_opn(int n)
 {
   int do_commit = 0;
 
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
+  log.reserved -= n;
+  if(log.freezing)
+    panic("log.freezing");
+  if(log.outstanding == 0 && !log.committing){
     do_commit = 1;
     log.committing = 1;
   } else {
@@ -167,44 +328,190 @@ end_op(void)
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
     commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Would a transaction of n blocks starting at log.head
+// have to wrap around to the start of the log?
+static int
+must_wrap(int n)
+{
+  return log.head + 1 + n > log.start + log.size;
+}
+
+// Is there room in the log for any transaction,
+// without a checkpoint first?
+static int
+room(void)
+{
+  uint waste = must_wrap(LOGSIZE) ? log.start + log.size - log.head : 0;
+
+  return log.nck + LOGSIZE <= NCKPT &&
+         log.used + waste + 1 + LOGSIZE <= log.size - 1;
+}
+
+// Write every block awaiting a checkpoint to its home
+// location, and forget the log written so far.
 static void
-write_log(void)
+checkpoint(void)
 {
-  int tail;
+  struct buf *b;
+  int i;
+
+  for (i = 0; i < log.nck; i++) {
+    b = &log.ck[i];
+    acquiresleep(&b->lock);
+    b->blockno = log.ckblock[i];  // home location
+    bwrite(b);
+    releasesleep(&b->lock);
+    bunpin(log.cached[i]);
+  }
+  acquire(&log.lock);
+  log.nck = 0;  // log_holds() reads it
+  release(&log.lock);
+  log.used = 0;
+  write_super(log.seq, log.head);
+}
+
+// Copy the running transaction's blocks from the cache into
+// the log's private buffers, and make it the committing
+// transaction. No FS system call may be active.
+static void
+freeze(void)
+{
+  struct buf *from;
+  int tail, i;
 
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    from = bread(log.dev, log.lh.block[tail]); // cache block
+    for (i = 0; i < log.nck; i++) {
+      if (log.ckblock[i] == from->blockno)
+        break;
+    }
+    if (i == log.nck) {
+      // keep the pin taken by log_write() until the checkpoint.
+      acquire(&log.lock);
+      log.ckblock[i] = from->blockno;
+      log.cached[i] = from;
+      log.nck++;
+      release(&log.lock);
+    } else {
+      bunpin(from);  // already pinned for the checkpoint
+    }
+    memmove(log.ck[i].data, from->data, BSIZE);
+    log.cidx[tail] = i;
+    log.clh.block[tail] = log.lh.block[tail];
     brelse(from);
-    brelse(to);
   }
+  log.clh.n = log.lh.n;
+  log.lh.n = 0;
+  bfreeze();
+}
+
+static uchar*
+frozen_data(int i)
+{
+  return log.ck[log.cidx[i]].data;
+}
+
+// Append the committing transaction to the log.
+// Once this returns, the transaction is committed.
+static void
+write_trans(void)
+{
+  struct buf *b;
+  uint pos;
+  int tail;
+
+  if (must_wrap(log.clh.n)) {
+    log.used += log.start + log.size - log.head;
+    log.head = log.start + 1;
+  }
+  pos = log.head;
+
+  for (tail = 0; tail < log.clh.n; tail++) {
+    b = &log.ck[log.cidx[tail]];
+    acquiresleep(&b->lock);
+    b->blockno = pos + 1 + tail;  // log block
+    bwrite(b);
+    releasesleep(&b->lock);
+  }
+
+  log.clh.magic = LOGMAGIC;
+  log.clh.seq = log.seq;
+  log.clh.cksum = trans_cksum(&log.clh, frozen_data);
+  b = &log.hbuf;
+  acquiresleep(&b->lock);
+  memset(b->data, 0, BSIZE);
+  memmove(b->data, &log.clh, sizeof(log.clh));
+  b->blockno = pos;
+  bwrite(b);
+  releasesleep(&b->lock);
+
+  log.head = pos + 1 + log.clh.n;
+  log.used += 1 + log.clh.n;
+  log.seq++;
+  log.clh.n = 0;
 }
 
+// Commit running transactions for as long as one is
+// ready, i.e. has blocks and no FS system call active.
+// Caller has set log.committing.
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  acquire(&log.lock);
+  while(log.outstanding == 0 && log.lh.n > 0){
+    release(&log.lock);
+    // only blocks of committed transactions await the
+    // checkpoint, so it can run while FS calls go on.
+    if(!room())
+      checkpoint();
+    acquire(&log.lock);
+    if(log.outstanding > 0)
+      break;  // a new system call joined; let it finish.
+
+    log.freezing = 1;
+    release(&log.lock);
+    freeze();
+    acquire(&log.lock);
+    log.freezing = 0;
+    wakeup(&log);  // the next transaction may start
+    release(&log.lock);
+
+    write_trans();   // Write header and blocks to log -- the real commit
+    bcommitted();    // blocks it freed may be reused
+
+    acquire(&log.lock);
   }
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// Does the log hold a copy of block blockno that it will
+// write home later? If so, a caller that wants to bwrite()
+// the block in place must log_write() it instead, or the
+// log's older copy would overwrite it at the checkpoint.
+// Caller is inside an FS system call, so the running
+// transaction cannot be frozen meanwhile.
+int
+log_holds(uint blockno)
+{
+  int i, held = 0;
+
+  acquire(&log.lock);
+  for (i = 0; i < log.lh.n && !held; i++)
+    held = (log.lh.block[i] == blockno);
+  for (i = 0; i < log.nck && !held; i++)
+    held = (log.ckblock[i] == blockno);
+  release(&log.lock);
+  return held;
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// commit()/write_trans() will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -217,7 +524,7 @@ log_write(struct buf *b)
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= LOGSIZE)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -228,9 +535,10 @@ log_write(struct buf *b)
   }
   log.lh.block[i] = b->blockno;
   if (i == log.lh.n) {  // Add new block to log?
+    if (i == 0)
+      log.opened = ticks;
     bpin(b);
     log.lh.n++;
   }
   release(&log.lock);
 }
-
@@ -18,6 +18,9 @@ main()
     printf("xv6 kernel is booting\n");
     printf("\n");
     kinit();         // physical page allocator
+#ifdef STRINGTEST
+    stringtest();    // check and time memmove() &c
+#endif
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
@@ -28,6 +31,8 @@ main()
     binit();         // buffer cache
     iinit();         // inode table
     fileinit();      // file table
+    vmainit();       // mapped file page cache
+    pipeinit();      // pipe cache
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
@@ -1,13 +1,20 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NVMA         16  // mapped regions per process
+#define NUTLB         4  // cached user translations per process
+#define MAGSIZE      16  // objects per CPU in a slab cache
+#define NIHASH      127  // hash buckets in the i-node cache
+#define NDENTRY     256  // directory name lookup cache entries
+#define NPIPEPAGE     4  // pages of buffer per pipe
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define LOGSIZE      (MAXOPBLOCKS*12) // max data blocks in one log transaction
+#define LOGBLOCKS    (LOGSIZE*3+1)    // size of on-disk circular log
+#define NCKPT        (LOGSIZE*2)      // max logged blocks awaiting a checkpoint
+#ifndef FSSIZE
+#define FSSIZE       4000  // size of file system in blocks
+#endif
 #define MAXPATH      128   // maximum file path name
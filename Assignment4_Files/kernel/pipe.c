@@ -7,18 +7,78 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "slab.h"
 
-#define PIPESIZE 512
+// A pipe holds its data in a ring of up to NPIPEPAGE page
+// segments, each a run of bytes [off, off+len) of one page.
+// write() appends to the last segment while its page has room
+// and is the pipe's own, and starts a new one otherwise.
+//
+// vmsplice() hands whole pages of the writer's memory to the
+// pipe by reference, and splice() reads file data straight into
+// pipe pages. A read() of a whole page into a page-aligned buffer
+// maps the segment's page into the reader instead of copying it.
+// Pages shared with a process are copy-on-write on both sides.
+//
+// Readers and writers copy to and from user memory without
+// holding the lock, since copying may fault in user pages and
+// sleep. The rbusy and wbusy flags keep out a second reader or
+// writer meanwhile; a writer only fills bytes past the end of
+// the last segment and a reader only drains bytes before it, and
+// wcopy stops a reader from freeing the segment being filled.
+struct pipeseg {
+  char *page;
+  uint off;
+  uint len;
+  int shared;     // page may be mapped by a process
+};
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  struct pipeseg seg[NPIPEPAGE];
+  uint head;      // index of the first segment
+  uint nseg;      // number of segments
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int rbusy;      // a reader is in piperead()
+  int wbusy;      // a writer is in pipewrite() or pipesplice()
+  int wcopy;      // the writer is filling the last segment
 };
 
+struct kmem_cache pipecache;
+
+void
+pipeinit(void)
+{
+  kmem_cache_init(&pipecache, "pipe", sizeof(struct pipe));
+}
+
+static struct pipeseg*
+pipetail(struct pipe *pi)
+{
+  return &pi->seg[(pi->head + pi->nseg - 1) % NPIPEPAGE];
+}
+
+// Drop the first segment, freeing its page if free is set.
+static void
+pipepop(struct pipe *pi, int free)
+{
+  if(free)
+    kfree(pi->seg[pi->head].page);
+  pi->head = (pi->head + 1) % NPIPEPAGE;
+  pi->nseg--;
+}
+
+static void
+pipefree(struct pipe *pi)
+{
+  while(pi->nseg > 0)
+    pipepop(pi, 1);
+  kmem_cache_free(&pipecache, pi);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,12 +88,11 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = kmem_cache_alloc(&pipecache)) == 0)
     goto bad;
+  memset(pi, 0, sizeof(*pi));
   pi->readopen = 1;
   pi->writeopen = 1;
-  pi->nwrite = 0;
-  pi->nread = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -47,7 +106,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    pipefree(pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,62 +127,250 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    pipefree(pi);
   } else
     release(&pi->lock);
 }
 
+// Wait until no other writer is active, then claim the pipe
+// for writing. Returns 0, or -1 if the reader has gone or the
+// caller was killed. Caller holds pi->lock.
+static int
+pipewbegin(struct pipe *pi)
+{
+  struct proc *pr = myproc();
+
+  while(pi->wbusy){
+    if(pi->readopen == 0 || killed(pr))
+      return -1;
+    sleep(&pi->wbusy, &pi->lock);
+  }
+  pi->wbusy = 1;
+  return 0;
+}
+
+static void
+pipewend(struct pipe *pi)
+{
+  pi->wbusy = 0;
+  wakeup(&pi->wbusy);
+  wakeup(&pi->nread);
+}
+
+// Find room for up to n more bytes, waiting while the pipe is
+// full: the rest of the last segment if its page is the pipe's
+// own, or else a new segment. Returns the address, with the
+// number of bytes that fit in *m, or 0 if the reader has gone,
+// the caller was killed, or memory ran out (*m is then -1).
+// Caller holds pi->lock and has claimed the pipe for writing.
+static char*
+piperoom(struct pipe *pi, int n, int *m)
+{
+  struct proc *pr = myproc();
+  struct pipeseg *t;
+  char *page;
+
+  for(;;){
+    if(pi->readopen == 0 || killed(pr)){
+      *m = -1;
+      return 0;
+    }
+    t = pi->nseg > 0 ? pipetail(pi) : 0;
+    if(t && !t->shared && t->off + t->len < PGSIZE)
+      break;
+    if(pi->nseg < NPIPEPAGE){
+      if((page = kalloc()) == 0){
+        *m = -1;
+        return 0;
+      }
+      pi->nseg++;
+      t = pipetail(pi);
+      t->page = page;
+      t->off = t->len = 0;
+      t->shared = 0;
+      break;
+    }
+    wakeup(&pi->nread); //DOC: pipewrite-full
+    sleep(&pi->nwrite, &pi->lock);
+  }
+  *m = PGSIZE - (t->off + t->len);
+  if(*m > n)
+    *m = n;
+  return t->page + t->off + t->len;
+}
+
+// Append page pa, which the pipe now holds a reference to,
+// as a segment of its own, waiting while the pipe is full.
+// Returns 0, or -1 if the reader has gone or the caller was
+// killed. Caller holds pi->lock and has claimed the pipe.
+static int
+pipeputpage(struct pipe *pi, char *pa)
+{
+  struct proc *pr = myproc();
+  struct pipeseg *t;
+
+  while(pi->nseg == NPIPEPAGE){
+    if(pi->readopen == 0 || killed(pr))
+      return -1;
+    wakeup(&pi->nread);
+    sleep(&pi->nwrite, &pi->lock);
+  }
+  if(pi->readopen == 0 || killed(pr))
+    return -1;
+  pi->nseg++;
+  t = pipetail(pi);
+  t->page = pa;
+  t->off = 0;
+  t->len = PGSIZE;
+  t->shared = 1;
+  pi->nwrite += PGSIZE;
+  wakeup(&pi->nread);
+  return 0;
+}
+
+// Write n bytes from user address addr. If gift is set, whole
+// pages at page-aligned addresses in the writer's heap, data or
+// stack are handed to the pipe instead of copied (vmsplice()).
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, uint64 addr, int n, int gift)
 {
-  int i = 0;
+  int i = 0, m, err = 0;
+  char *buf;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
+  if(pipewbegin(pi) < 0){
+    release(&pi->lock);
+    return -1;
+  }
   while(i < n){
-    if(pi->readopen == 0 || killed(pr)){
-      release(&pi->lock);
-      return -1;
-    }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
-      sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+    if(gift && (addr + i) % PGSIZE == 0 && n - i >= PGSIZE &&
+       (buf = uvmlend(pr, addr + i)) != 0){
+      if(pipeputpage(pi, buf) < 0){
+        kfree(buf);
+        err = 1;
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      }
+      i += PGSIZE;
+      continue;
+    }
+    if((buf = piperoom(pi, n - i, &m)) == 0){
+      err = pi->readopen == 0 || killed(pr) || i == 0;
+      break;
+    }
+    if(gift && m > PGSIZE - (addr + i) % PGSIZE)
+      m = PGSIZE - (addr + i) % PGSIZE;
+    pi->wcopy = 1;
+    release(&pi->lock);
+    if(copyin(pr->pagetable, buf, addr + i, m) == -1){
+      acquire(&pi->lock);
+      pi->wcopy = 0;
+      break;
     }
+    acquire(&pi->lock);
+    pi->wcopy = 0;
+    pipetail(pi)->len += m;
+    pi->nwrite += m;
+    i += m;
+    wakeup(&pi->nread);
   }
-  wakeup(&pi->nread);
+  pipewend(pi);
   release(&pi->lock);
 
-  return i;
+  return err ? -1 : i;
 }
 
+// Move up to n bytes of f, an open regular file, into the pipe
+// without copying them through user memory. Returns the number
+// of bytes moved, which is 0 at end of file, or -1.
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+pipesplice(struct pipe *pi, struct file *f, int n)
 {
-  int i;
+  int i = 0, m, r, err = 0;
+  char *buf;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  if(pipewbegin(pi) < 0){
+    release(&pi->lock);
+    return -1;
+  }
+  while(i < n){
+    if((buf = piperoom(pi, n - i, &m)) == 0){
+      err = pi->readopen == 0 || killed(pr) || i == 0;
+      break;
+    }
+    pi->wcopy = 1;
+    release(&pi->lock);
+    ilock(f->ip);
+    if((r = readi(f->ip, 0, (uint64)buf, f->off, m)) > 0)
+      f->off += r;
+    iunlock(f->ip);
+    acquire(&pi->lock);
+    pi->wcopy = 0;
+    if(r <= 0){
+      err = r < 0 && i == 0;
+      break;
+    }
+    pipetail(pi)->len += r;
+    pi->nwrite += r;
+    i += r;
+    wakeup(&pi->nread);
+  }
+  pipewend(pi);
+  release(&pi->lock);
+
+  return err ? -1 : i;
+}
+
+int
+piperead(struct pipe *pi, uint64 addr, int n, int nonblock)
+{
+  int i = 0, m;
+  struct pipeseg *h;
+  struct proc *pr = myproc();
+
+  acquire(&pi->lock);
+  while(pi->rbusy || (pi->nread == pi->nwrite && pi->writeopen)){  //DOC: pipe-empty
     if(killed(pr)){
       release(&pi->lock);
       return -1;
     }
-    sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
+    if(pi->rbusy)
+      sleep(&pi->rbusy, &pi->lock);
+    else if(nonblock){
+      release(&pi->lock);
+      return -1;
+    } else
+      sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  pi->rbusy = 1;
+  while(i < n && pi->nread != pi->nwrite){  //DOC: piperead-copy
+    h = &pi->seg[pi->head];
+    if(h->off == 0 && h->len == PGSIZE && (addr + i) % PGSIZE == 0 &&
+       n - i >= PGSIZE && uvmgive(pr, addr + i, h->page) == 0){
+      // the page now belongs to the reader's page table
+      pipepop(pi, 0);
+      pi->nread += PGSIZE;
+      i += PGSIZE;
+      continue;
+    }
+    m = h->len < n - i ? h->len : n - i;
+    release(&pi->lock);
+    if(copyout(pr->pagetable, addr + i, h->page + h->off, m) == -1){
+      acquire(&pi->lock);
       break;
+    }
+    acquire(&pi->lock);
+    h->off += m;
+    h->len -= m;
+    pi->nread += m;
+    i += m;
+    if(h->len == 0 && !(pi->nseg == 1 && pi->wcopy))
+      pipepop(pi, 1);
   }
+  pi->rbusy = 0;
+  wakeup(&pi->rbusy);
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
   return i;
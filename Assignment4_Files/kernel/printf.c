@@ -17,14 +17,264 @@
 
 volatile int panicked = 0;
 
-// lock to avoid interleaving concurrent printf's.
-static struct {
-  struct spinlock lock;
-  int locking;
-} pr;
+// Kernel log.
+//
+// printf() does not write to the UART itself, which would
+// stall the CPU for the whole transmit time. Instead each CPU
+// appends its output, with interrupts off and no lock, to its
+// own ring of NLOGREC records, one or more per printf() call,
+// each stamped with a global sequence number when complete.
+// klogdrain(), called from the clock and UART interrupts,
+// moves complete records to the UART's transmit buffer in
+// sequence order, and dmesg() copies the records the rings
+// still hold to user space.
+//
+// A record's seq is 0 while its CPU is filling it, so a reader
+// that copies a record and finds the same non-zero seq before
+// and after knows that it was not overwritten meanwhile. A ring
+// that fills up overwrites its oldest records, but only once
+// they have reached the console. If every record in the ring
+// still waits for the console, printf() drops its output
+// rather than wait for the UART, and counts the records it
+// dropped; the next record it keeps starts with that count.
+// dmesg() only gets what is left of the history.
+//
+// Once panic() is called, printf() writes to the UART directly.
+
+#define NLOGREC 64     // records in each CPU's ring
+
+#define LOGFILL 1      // rec[w % NLOGREC] is being filled
+#define LOGDROP 2      // the ring was full: discarding a record
+
+struct logrec {
+  uint64 seq;
+  uint len;
+  char text[116];
+};
+
+struct logring {
+  struct logrec rec[NLOGREC];
+  uint64 w;            // records completed
+  int open;            // LOGFILL or LOGDROP while in a record
+  uint dlen;           // bytes of the record being dropped
+  uint dropped;        // records dropped since the last one kept
+  uint64 r;            // next record for the console
+  uint roff;           // bytes of it already sent
+};
 
 static char digits[] = "0123456789abcdef";
 
+static struct {
+  struct spinlock lock;  // serializes klogdrain()
+  uint64 seq;            // last sequence number handed out
+  int sync;              // write straight to the UART
+  struct logring cpu[NCPU];
+} klog;
+
+// Finish the record being filled on ring g.
+static void
+klogcommit(struct logring *g)
+{
+  if(g->open != LOGFILL){
+    g->open = 0;
+    return;
+  }
+  __sync_synchronize();
+  g->rec[g->w % NLOGREC].seq = __sync_add_and_fetch(&klog.seq, 1);
+  __sync_synchronize();
+  g->w++;
+  g->open = 0;
+}
+
+// Append c to this CPU's ring. Interrupts are off.
+static void
+klogputc(int c)
+{
+  struct logring *g = &klog.cpu[cpuid()];
+  struct logrec *rec = &g->rec[g->w % NLOGREC];
+  char buf[16];
+  uint x;
+  int i;
+
+  if(!g->open){
+    if(g->w - *(volatile uint64 *)&g->r >= NLOGREC){
+      // rec has not reached the console yet.
+      g->dropped++;
+      g->dlen = 0;
+      g->open = LOGDROP;
+    } else {
+      rec->seq = 0;
+      __sync_synchronize();
+      rec->len = 0;
+      g->open = LOGFILL;
+      if(g->dropped){
+        i = 0;
+        x = g->dropped;
+        do {
+          buf[i++] = digits[x % 10];
+        } while((x /= 10) != 0);
+        memmove(rec->text, "klog: ", 6);
+        rec->len = 6;
+        while(--i >= 0)
+          rec->text[rec->len++] = buf[i];
+        memmove(rec->text + rec->len, " records dropped\n", 17);
+        rec->len += 17;
+        g->dropped = 0;
+      }
+    }
+  }
+  if(g->open == LOGDROP){
+    if(++g->dlen == sizeof(rec->text))
+      g->open = 0;
+    return;
+  }
+  rec->text[rec->len++] = c;
+  if(rec->len == sizeof(rec->text))
+    klogcommit(g);
+}
+
+// Copy record i of ring g into *rec.
+// Returns 0, or -1 if it is not complete or was overwritten.
+static int
+klogget(struct logring *g, uint64 i, struct logrec *rec)
+{
+  struct logrec *src = &g->rec[i % NLOGREC];
+  uint64 seq;
+
+  if(i >= *(volatile uint64 *)&g->w)
+    return -1;
+  __sync_synchronize();
+  seq = src->seq;
+  __sync_synchronize();
+  *rec = *src;
+  __sync_synchronize();
+  if(seq == 0 || src->seq != seq || rec->len > sizeof(rec->text))
+    return -1;
+  return 0;
+}
+
+// Find the oldest complete record at or after the cursors
+// cur[], skipping records that were overwritten. Returns its
+// ring's index with the record in *rec, or -1 if there is none.
+static int
+kloganext(uint64 *cur, struct logrec *rec)
+{
+  struct logring *g;
+  struct logrec r;
+  uint64 w;
+  int id, best = -1;
+
+  for(id = 0; id < NCPU; id++){
+    g = &klog.cpu[id];
+    for(;;){
+      w = *(volatile uint64 *)&g->w;
+      if(cur[id] + NLOGREC < w)
+        cur[id] = w - NLOGREC;  // overwritten
+      if(cur[id] >= w)
+        break;
+      if(klogget(g, cur[id], &r) == 0){
+        if(best < 0 || r.seq < rec->seq){
+          best = id;
+          *rec = r;
+        }
+        break;
+      }
+      cur[id]++;  // being overwritten
+    }
+  }
+  return best;
+}
+
+// Move complete records to the UART, as many as
+// its transmit buffer has room for.
+void
+klogdrain(void)
+{
+  uint64 cur[NCPU];
+  struct logrec rec;
+  int id, n;
+
+  acquire(&klog.lock);
+  for(id = 0; id < NCPU; id++)
+    cur[id] = klog.cpu[id].r;
+  while((id = kloganext(cur, &rec)) >= 0){
+    if(cur[id] != klog.cpu[id].r)
+      klog.cpu[id].roff = 0;
+    klog.cpu[id].r = cur[id];
+    n = uarttryput(rec.text + klog.cpu[id].roff, rec.len - klog.cpu[id].roff);
+    klog.cpu[id].roff += n;
+    if(klog.cpu[id].roff < rec.len)
+      break;
+    klog.cpu[id].r = ++cur[id];
+    klog.cpu[id].roff = 0;
+  }
+  release(&klog.lock);
+}
+
+// Copy up to n bytes of the most recent log records to user
+// address dst. Returns the number of bytes copied, or -1.
+int
+klogread(uint64 dst, int n)
+{
+  uint64 cur[NCPU];
+  struct logrec rec;
+  int id, total, skip, off, m;
+
+  // once to see how much there is, then again to copy
+  // what fits, dropping the oldest.
+  for(id = 0; id < NCPU; id++)
+    cur[id] = 0;
+  for(total = 0; (id = kloganext(cur, &rec)) >= 0; cur[id]++)
+    total += rec.len;
+  skip = total > n ? total - n : 0;
+
+  for(id = 0; id < NCPU; id++)
+    cur[id] = 0;
+  for(off = 0; off < n && (id = kloganext(cur, &rec)) >= 0; cur[id]++){
+    m = rec.len;
+    if(skip >= m){
+      skip -= m;
+      continue;
+    }
+    m -= skip;
+    if(m > n - off)
+      m = n - off;
+    if(copyout(myproc()->pagetable, dst + off, rec.text + skip, m) < 0)
+      return -1;
+    skip = 0;
+    off += m;
+  }
+  return off;
+}
+
+// Send whatever the rings hold straight to the UART,
+// without locks, for panic().
+static void
+klogflush(void)
+{
+  uint64 cur[NCPU];
+  struct logrec rec;
+  int id, i;
+
+  for(id = 0; id < NCPU; id++)
+    cur[id] = klog.cpu[id].r;
+  while((id = kloganext(cur, &rec)) >= 0){
+    i = cur[id] == klog.cpu[id].r ? klog.cpu[id].roff : 0;
+    for(; i < rec.len; i++)
+      consputc(rec.text[i]);
+    cur[id]++;
+  }
+}
+
+static void
+putch(int c)
+{
+  if(klog.sync)
+    consputc(c);
+  else
+    klogputc(c);
+}
+
 static void
 printint(int xx, int base, int sign)
 {
@@ -46,38 +296,36 @@ printint(int xx, int base, int sign)
     buf[i++] = '-';
 
   while(--i >= 0)
-    consputc(buf[i]);
+    putch(buf[i]);
 }
 
 static void
 printptr(uint64 x)
 {
   int i;
-  consputc('0');
-  consputc('x');
+  putch('0');
+  putch('x');
   for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
-    consputc(digits[x >> (sizeof(uint64) * 8 - 4)]);
+    putch(digits[x >> (sizeof(uint64) * 8 - 4)]);
 }
 
-// Print to the console. only understands %d, %x, %p, %s.
+// Print to the kernel log. only understands %d, %x, %p, %s.
 void
 printf(char *fmt, ...)
 {
   va_list ap;
-  int i, c, locking;
+  int i, c;
   char *s;
 
-  locking = pr.locking;
-  if(locking)
-    acquire(&pr.lock);
-
   if (fmt == 0)
     panic("null fmt");
 
+  push_off();
+
   va_start(ap, fmt);
   for(i = 0; (c = fmt[i] & 0xff) != 0; i++){
     if(c != '%'){
-      consputc(c);
+      putch(c);
       continue;
     }
     c = fmt[++i] & 0xff;
@@ -97,28 +345,32 @@ printf(char *fmt, ...)
       if((s = va_arg(ap, char*)) == 0)
         s = "(null)";
       for(; *s; s++)
-        consputc(*s);
+        putch(*s);
       break;
     case '%':
-      consputc('%');
+      putch('%');
       break;
     default:
       // Print unknown % sequence to draw attention.
-      consputc('%');
-      consputc(c);
+      putch('%');
+      putch(c);
       break;
     }
   }
   va_end(ap);
 
-  if(locking)
-    release(&pr.lock);
+  if(!klog.sync)
+    klogcommit(&klog.cpu[cpuid()]);
+  pop_off();
 }
 
 void
 panic(char *s)
 {
-  pr.locking = 0;
+  if(!klog.sync){
+    klog.sync = 1;
+    klogflush();
+  }
   printf("panic: ");
   printf(s);
   printf("\n");
@@ -130,6 +382,5 @@ panic(char *s)
 void
 printfinit(void)
 {
-  initlock(&pr.lock, "pr");
-  pr.locking = 1;
+  initlock(&klog.lock, "klog");
 }
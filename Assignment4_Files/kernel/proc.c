@@ -158,6 +158,7 @@ freeproc(struct proc *p)
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
+  utlbflush(p);
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
@@ -264,9 +265,11 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    // only reserve the address space; uvmfault() fills
+    // in each page when the process first touches it.
+    if(sz + n > vmalow(p))
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
@@ -295,6 +298,11 @@ fork(void)
     return -1;
   }
   np->sz = p->sz;
+  if(vmacopy(p, np) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -351,6 +359,9 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // Unmap mapped regions, writing back shared file pages.
+  vmaunmapall(p, p->pagetable, 1);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
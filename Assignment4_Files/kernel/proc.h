@@ -81,6 +81,35 @@ struct trapframe {
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A region mapped by mmap(); see vma.c.
+struct vma {
+  uint64 addr;
+  uint64 len;                  // 0 if this slot is unused
+  int prot;                    // PROT_READ, PROT_WRITE
+  int flags;                   // MAP_SHARED or MAP_PRIVATE
+  struct file *f;              // mapped file; 0 for anonymous memory
+  uint off;                    // offset in f of addr
+};
+
+// A cached translation of a user page (see useraddr()).
+// It points at the leaf PTE rather than holding the physical
+// address, so changes to the mapping need not invalidate it;
+// only freeing the page table does.
+struct utlb {
+  uint64 va;                   // page-aligned user address
+  pte_t *pte;                  // its leaf PTE; 0 if this slot is unused
+};
+
+// A user (or kernel) buffer that is copied to or from a
+// piece at a time; see uspaninit().
+struct uspan {
+  int user;                    // va is a user address
+  int write;                   // copying into the buffer
+  uint64 va;                   // next address to copy
+  uint64 end;                  // end of the buffer
+  char *kva;                   // kernel address of va, 0 if not known
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -103,5 +132,8 @@ struct proc {
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct vma vma[NVMA];        // Mapped regions
+  struct utlb utlb[NUTLB];     // Recent user translations
+  int utlbnext;                // utlb slot to replace next
   char name[16];               // Process name (debugging)
 };
@@ -9,6 +9,31 @@
 #include "riscv.h"
 #include "defs.h"
 #include "proc.h"
+#include "slab.h"
+
+// The 8-bit LFSR below visits every non-zero byte in a
+// fixed cycle of 255 steps, so the bytes that follow any seed
+// are a run of that cycle. randominit() writes the cycle out
+// once, repeated, and a read copies runs of it to the reader
+// in bulk instead of stepping the LFSR a byte at a time.
+#define LFSR_PERIOD 255
+#define RANDRUN (LFSR_PERIOD*15)  // most bytes copied at once
+
+// A file on the device that has been given an 8-byte seed
+// reads its own stream instead: xorshift64*, eight bytes a
+// step, with the state in an rstream that randomopen() hangs
+// off the file's priv, under that rstream's own lock. Bytes of
+// a step that a read does not use are kept for the next, so
+// the stream does not depend on how it is read. Such readers
+// neither share random.lock nor see each other's seeds.
+struct rstream {
+    struct spinlock lock;  // protects the rest
+    uint64 state;          // 0 while the file reads the shared stream
+    uint64 word;           // output of the last step,
+    int left;              // left bytes of it not yet read
+};
+
+static struct kmem_cache rstreamcache;
 
 // anonymous struct, to create only one instance
 struct{
@@ -16,10 +41,15 @@ struct{
     uint8 random_seed ;
 } random;
 
+static uint8 lfsr_seq[LFSR_PERIOD + RANDRUN];  // the cycle, repeated
+static uint8 lfsr_pos[256];                    // where each byte is in it
+
 uint8 lfsr_char(uint8 lfsr);
 void randominit(void);
-int randomwrite(int fd, const uint64 src, int n);
-int randomread(int fd, uint64 dst, int n);
+int randomwrite(struct file *f, int user_src, const uint64 src, int n);
+int randomread(struct file *f, int user_dst, uint64 dst, int n);
+int randomopen(struct file *f);
+void randomclose(struct file *f);
 // Linear feedback shift register
 // Returns the next pseudo-random number
 // The seed is updated with the returned value
@@ -31,48 +61,163 @@ uint8 lfsr_char(uint8 lfsr)
     return lfsr;
 }
 
+// Step a file's own stream, returning its next eight bytes
+// The state must not be 0
+static uint64 xorshift64(uint64 *state)
+{
+    uint64 x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
 void randominit(void) {
     initlock(&random.lock, "random");
+    kmem_cache_init(&rstreamcache, "rstream", sizeof(struct rstream));
     uartinit();
 
     random.random_seed = 0x2A;
+    lfsr_seq[0] = 1;
+    for (int i = 1; i < sizeof(lfsr_seq); i++)
+        lfsr_seq[i] = lfsr_char(lfsr_seq[i - 1]);
+    for (int i = 0; i < LFSR_PERIOD; i++)
+        lfsr_pos[lfsr_seq[i]] = i;
     devsw[RANDOM].read = randomread;
     devsw[RANDOM].write = randomwrite;
+    devsw[RANDOM].open = randomopen;
+    devsw[RANDOM].close = randomclose;
 }
 
-int randomwrite(int fd, const uint64 src, int n) {
-    if (n != 1){
+// Give a newly opened file the shared stream, and room
+// for a stream of its own.
+int randomopen(struct file *f) {
+    struct rstream *s;
+
+    if ((s = kmem_cache_alloc(&rstreamcache)) == 0)
         return -1;
+    memset(s, 0, sizeof(*s));
+    initlock(&s->lock, "rstream");
+    f->priv = s;
+    return 0;
+}
+
+void randomclose(struct file *f) {
+    kmem_cache_free(&rstreamcache, f->priv);
+}
+
+// A 1-byte write reseeds the shared stream, an 8-byte write
+// gives f a stream of its own seeded with those bytes, or, if
+// they are all 0, puts f back on the shared stream.
+int randomwrite(struct file *f, int user_src, const uint64 src, int n) {
+    struct rstream *s = f->priv;
+    uint8 seed;
+    uint64 seed64;
+
+    if (n == 8) {
+        if (either_copyin(&seed64, user_src, src, 8) == -1)
+            return -1;
+        acquire(&s->lock);
+        s->state = seed64;
+        s->left = 0;
+        release(&s->lock);
+        return 8;
     }
-    
-    acquire(&random.lock);
-    if(either_copyin(&random.random_seed, fd, src, 1) == -1) {
-        release(&random.lock);
+    if (n != 1){
         return -1;
     }
+
+    if (either_copyin(&seed, user_src, src, 1) == -1)
+        return -1;
+    acquire(&random.lock);
+    random.random_seed = seed;
     release(&random.lock);
 
     return 1;
 }
 
-int randomread(int fd, uint64 dst, int n) {
-    int counter;
-    counter = 0;
-    
-    while (n > 0) {
-        acquire(&random.lock);
-        random.random_seed = lfsr_char(random.random_seed);
-
-        if (either_copyout(fd, dst, &random.random_seed, 1) == -1){
-            release(&random.lock);
-            return counter;
+// Read n bytes of a file's own stream s. Processes sharing
+// the file each get a separate part of it.
+static int randomread_file(struct rstream *s, struct uspan *u, int n) {
+    uint8 buf[64];
+    uint64 w;
+    int i, m, left;
+
+    for (left = n; left > 0; left -= m) {
+        m = left < sizeof(buf) ? left : sizeof(buf);
+        acquire(&s->lock);
+        if (s->state == 0) {
+            // put back on the shared stream meanwhile
+            release(&s->lock);
+            return n - left;
+        }
+        for (i = 0; i < m; ) {
+            if (s->left == 0 && m - i >= 8) {
+                w = xorshift64(&s->state);
+                memmove(buf + i, &w, 8);
+                i += 8;
+            } else {
+                if (s->left == 0) {
+                    s->word = xorshift64(&s->state);
+                    s->left = 8;
+                }
+                // a step's bytes go out lowest first
+                buf[i++] = s->word >> (8 * (8 - s->left--));
+            }
         }
-        counter++;
-        n--;
-        release(&random.lock);
+        release(&s->lock);
+        if (uspanout(u, buf, m) == -1)
+            return -1;
+    }
+    return n;
+}
+
+
+int randomread(struct file *f, int user_dst, uint64 dst, int n) {
+    struct rstream *s = f->priv;
+    struct uspan u;
+    uint8 seed;
+    uint8 zero[64];
+    int pos, m, left;
+
+    if (n < 0)
+        return -1;
+    // fault in dst first, so that the copies below cannot fail
+    // after the bytes have been taken from the stream.
+    if (uspaninit(&u, user_dst, dst, n, 1) == -1)
+        return -1;
+    if (__atomic_load_n(&s->state, __ATOMIC_RELAXED) != 0)
+        return randomread_file(s, &u, n);
+
+    // take the next n bytes of the stream: the last of them
+    // is the new seed.
+    acquire(&random.lock);
+    seed = random.random_seed;
+    if (seed != 0)
+        random.random_seed = lfsr_seq[(lfsr_pos[seed] + n) % LFSR_PERIOD];
+    release(&random.lock);
+
+    if (seed == 0) {
+        // 0 is the one byte outside the cycle, and repeats.
+        memset(zero, 0, sizeof(zero));
+        for (left = n; left > 0; left -= m) {
+            m = left < sizeof(zero) ? left : sizeof(zero);
+            if (uspanout(&u, zero, m) == -1)
+                return -1;
+        }
+        return n;
+    }
+
+    pos = (lfsr_pos[seed] + 1) % LFSR_PERIOD;
+    for (left = n; left > 0; left -= m) {
+        m = left < RANDRUN ? left : RANDRUN;
+        if (uspanout(&u, &lfsr_seq[pos], m) == -1)
+            return -1;
+        pos = (pos + m) % LFSR_PERIOD;
     }
 
-    return counter;
+    return n;
 }
 
 
@@ -0,0 +1,169 @@
+// Slab allocator for small kernel objects.
+//
+// A kmem_cache hands out objects of one size. Objects live
+// in slabs, pages from kalloc() that start with a struct
+// slab and are cut into as many objects as fit.
+//
+// Each CPU keeps a magazine of up to MAGSIZE free objects
+// of every cache, used with interrupts off and no lock, so
+// allocating and freeing are usually a few instructions.
+// An empty magazine is refilled with half a magazine from
+// the cache's slabs, and a full one gives half back, under
+// the cache's lock. A slab whose objects are all free is
+// returned to kalloc() unless it is the cache's only one.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "slab.h"
+
+struct slab {
+  struct kmem_cache *cache;
+  struct slab *next;    // on cache->partial
+  struct slab *prev;
+  uint inuse;           // objects handed out, including to magazines
+  void *free;           // list of free objects, through their first word
+};
+
+#define SLABHDR ((sizeof(struct slab) + 7) & ~7)
+
+void
+kmem_cache_init(struct kmem_cache *c, char *name, uint size)
+{
+  int i;
+
+  c->name = name;
+  c->size = (size + 7) & ~7;
+  if(c->size < sizeof(void*) || c->size > PGSIZE - SLABHDR)
+    panic("kmem_cache_init: size");
+  c->perslab = (PGSIZE - SLABHDR) / c->size;
+  initlock(&c->lock, name);
+  c->partial = 0;
+  for(i = 0; i < NCPU; i++)
+    c->mag[i].n = 0;
+}
+
+static void
+partial_add(struct kmem_cache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(c->partial)
+    c->partial->prev = s;
+  c->partial = s;
+}
+
+static void
+partial_remove(struct kmem_cache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Make a new slab for c. Caller holds c->lock.
+static struct slab*
+slab_grow(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *o;
+  int i;
+
+  if((s = kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->inuse = 0;
+  s->free = 0;
+  o = (char*)s + SLABHDR + (c->perslab - 1) * c->size;
+  for(i = 0; i < c->perslab; i++, o -= c->size){
+    *(void**)o = s->free;
+    s->free = o;
+  }
+  partial_add(c, s);
+  return s;
+}
+
+// Move up to n objects from c's slabs into magazine m.
+// Caller holds c->lock.
+static void
+mag_fill(struct kmem_cache *c, struct magazine *m, int n)
+{
+  struct slab *s;
+  void *o;
+
+  while(n > 0){
+    if((s = c->partial) == 0 && (s = slab_grow(c)) == 0)
+      return;
+    while(n > 0 && (o = s->free) != 0){
+      s->free = *(void**)o;
+      s->inuse++;
+      m->obj[m->n++] = o;
+      n--;
+    }
+    if(s->free == 0)
+      partial_remove(c, s);
+  }
+}
+
+// Return object o to its slab. Caller holds c->lock.
+static void
+slab_put(struct kmem_cache *c, void *o)
+{
+  struct slab *s = (struct slab*)PGROUNDDOWN((uint64)o);
+
+  if(s->cache != c)
+    panic("kmem_cache_free: wrong cache");
+  if(s->free == 0)
+    partial_add(c, s);
+  *(void**)o = s->free;
+  s->free = o;
+  if(--s->inuse == 0 && (s->next || s->prev)){
+    partial_remove(c, s);
+    kfree(s);
+  }
+}
+
+// Allocate an object from c. Its contents are undefined.
+// Returns 0 if memory has run out.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct magazine *m;
+  void *o = 0;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    mag_fill(c, m, MAGSIZE / 2);
+    release(&c->lock);
+  }
+  if(m->n > 0)
+    o = m->obj[--m->n];
+  pop_off();
+  return o;
+}
+
+// Give object o, from kmem_cache_alloc(c), back to c.
+void
+kmem_cache_free(struct kmem_cache *c, void *o)
+{
+  struct magazine *m;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == MAGSIZE){
+    acquire(&c->lock);
+    while(m->n > MAGSIZE / 2)
+      slab_put(c, m->obj[--m->n]);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = o;
+  pop_off();
+}
@@ -0,0 +1,12 @@
+// Cache of equally sized kernel objects, carved from pages.
+struct kmem_cache {
+  char *name;          // Name of cache.
+  uint size;           // Object size, a multiple of 8.
+  uint perslab;        // Objects per page.
+  struct spinlock lock;
+  struct slab *partial; // Slabs with free objects.
+  struct magazine {
+    int n;
+    void *obj[MAGSIZE];
+  } mag[NCPU];         // Objects kept by each CPU.
+};
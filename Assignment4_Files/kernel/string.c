@@ -1,13 +1,40 @@
 #include "types.h"
 
+// memset, memcmp and memmove work a 64-bit word at a time,
+// eight words per loop iteration, once the addresses are
+// aligned, with byte loops for the unaligned head and tail.
+// If dst and src differ in alignment, memmove and memcmp fall
+// back to bytes, since RISC-V may trap on misaligned accesses.
+
+#define WSIZE sizeof(uint64)
+#define WMASK (WSIZE - 1)
+
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 w, *wdst;
+
+  while(n > 0 && ((uint64)cdst & WMASK)){
+    *cdst++ = c;
+    n--;
+  }
+  if(n >= WSIZE){
+    w = (uchar)c;
+    w |= w << 8;
+    w |= w << 16;
+    w |= w << 32;
+    wdst = (uint64 *) cdst;
+    for(; n >= 8*WSIZE; n -= 8*WSIZE, wdst += 8){
+      wdst[0] = w; wdst[1] = w; wdst[2] = w; wdst[3] = w;
+      wdst[4] = w; wdst[5] = w; wdst[6] = w; wdst[7] = w;
+    }
+    for(; n >= WSIZE; n -= WSIZE)
+      *wdst++ = w;
+    cdst = (char *) wdst;
   }
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -15,9 +42,24 @@ int
 memcmp(const void *v1, const void *v2, uint n)
 {
   const uchar *s1, *s2;
+  const uint64 *w1, *w2;
 
   s1 = v1;
   s2 = v2;
+  if((((uint64)s1 ^ (uint64)s2) & WMASK) == 0){
+    while(n > 0 && ((uint64)s1 & WMASK)){
+      if(*s1 != *s2)
+        return *s1 - *s2;
+      s1++, s2++, n--;
+    }
+    // skip equal words; the byte loop finds the difference.
+    w1 = (const uint64 *) s1;
+    w2 = (const uint64 *) s2;
+    for(; n >= WSIZE && *w1 == *w2; n -= WSIZE)
+      w1++, w2++;
+    s1 = (const uchar *) w1;
+    s2 = (const uchar *) w2;
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -32,20 +74,59 @@ memmove(void *dst, const void *src, uint n)
 {
   const char *s;
   char *d;
+  const uint64 *ws;
+  uint64 *wd;
+  int aligned;
 
   if(n == 0)
     return dst;
   
   s = src;
   d = dst;
+  aligned = (((uint64)s ^ (uint64)d) & WMASK) == 0;
   if(s < d && s + n > d){
     s += n;
     d += n;
+    if(aligned){
+      while(n > 0 && ((uint64)d & WMASK)){
+        *--d = *--s;
+        n--;
+      }
+      ws = (const uint64 *) s;
+      wd = (uint64 *) d;
+      for(; n >= 8*WSIZE; n -= 8*WSIZE){
+        ws -= 8;
+        wd -= 8;
+        wd[7] = ws[7]; wd[6] = ws[6]; wd[5] = ws[5]; wd[4] = ws[4];
+        wd[3] = ws[3]; wd[2] = ws[2]; wd[1] = ws[1]; wd[0] = ws[0];
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *--wd = *--ws;
+      s = (const char *) ws;
+      d = (char *) wd;
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    if(aligned){
+      while(n > 0 && ((uint64)d & WMASK)){
+        *d++ = *s++;
+        n--;
+      }
+      ws = (const uint64 *) s;
+      wd = (uint64 *) d;
+      for(; n >= 8*WSIZE; n -= 8*WSIZE, ws += 8, wd += 8){
+        wd[0] = ws[0]; wd[1] = ws[1]; wd[2] = ws[2]; wd[3] = ws[3];
+        wd[4] = ws[4]; wd[5] = ws[5]; wd[6] = ws[6]; wd[7] = ws[7];
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *wd++ = *ws++;
+      s = (const char *) ws;
+      d = (char *) wd;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
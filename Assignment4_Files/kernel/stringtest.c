@@ -0,0 +1,178 @@
+//
+// Boot-time check and benchmark of memmove(), memset() and
+// memcmp(), built in with make STRINGTEST=1. Each routine is
+// compared against a byte loop for every alignment of source
+// and destination and a range of lengths, including
+// overlapping moves, and then timed on whole pages.
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NTIME 256   // page operations per timing run
+
+static char *buf, *ref;
+
+static void
+fill(char *p, uint n, int seed)
+{
+  uint i;
+
+  for(i = 0; i < n; i++)
+    p[i] = (i * 7 + seed) ^ (i >> 8);
+}
+
+static void
+bytemove(char *d, const char *s, uint n)
+{
+  if(s < d && s + n > d){
+    while(n-- > 0)
+      d[n] = s[n];
+  } else {
+    while(n-- > 0)
+      *d++ = *s++;
+  }
+}
+
+static void
+byteset(char *d, int c, uint n)
+{
+  while(n-- > 0)
+    *d++ = c;
+}
+
+static int
+bytecmp(const uchar *a, const uchar *b, uint n)
+{
+  for(; n > 0; n--, a++, b++)
+    if(*a != *b)
+      return *a - *b;
+  return 0;
+}
+
+static int
+sign(int x)
+{
+  return x < 0 ? -1 : x > 0;
+}
+
+static void
+check(int ok, char *what, int soff, int doff, int n)
+{
+  if(!ok){
+    printf("stringtest: %s wrong, src+%d dst+%d n %d\n", what, soff, doff, n);
+    panic("stringtest");
+  }
+}
+
+static uint lens[] = { 0, 1, 7, 8, 9, 63, 64, 65, 200, 1000 };
+
+static void
+correctness(void)
+{
+  int soff, doff, i, k;
+  uint n;
+
+  for(soff = 0; soff < 16; soff++){
+    for(doff = 0; doff < 16; doff++){
+      for(i = 0; i < NELEM(lens); i++){
+        n = lens[i];
+
+        // disjoint move
+        fill(buf, PGSIZE, 1);
+        fill(ref, PGSIZE, 1);
+        memmove(buf + 2048 + doff, buf + soff, n);
+        bytemove(ref + 2048 + doff, ref + soff, n);
+        check(bytecmp((uchar*)buf, (uchar*)ref, PGSIZE) == 0, "memmove", soff, doff, n);
+
+        // overlapping moves, both directions
+        memmove(buf + soff + 8, buf + doff + 16, n);
+        bytemove(ref + soff + 8, ref + doff + 16, n);
+        memmove(buf + doff + 16, buf + soff + 8, n);
+        bytemove(ref + doff + 16, ref + soff + 8, n);
+        check(bytecmp((uchar*)buf, (uchar*)ref, PGSIZE) == 0, "overlapping memmove", soff, doff, n);
+
+        memset(buf + doff, soff, n);
+        byteset(ref + doff, soff, n);
+        check(bytecmp((uchar*)buf, (uchar*)ref, PGSIZE) == 0, "memset", soff, doff, n);
+
+        // memcmp of equal runs, then with one byte changed
+        fill(buf, PGSIZE, 2);
+        memmove(buf + 2048 + doff, buf + soff, n);
+        check(memcmp(buf + soff, buf + 2048 + doff, n) == 0, "memcmp", soff, doff, n);
+        if(n > 0){
+          k = (n * 5) / 7;
+          buf[2048 + doff + k] ^= 0x81;
+          check(sign(memcmp(buf + soff, buf + 2048 + doff, n)) ==
+                sign(bytecmp((uchar*)buf + soff, (uchar*)buf + 2048 + doff, n)),
+                "memcmp", soff, doff, n);
+        }
+      }
+    }
+  }
+}
+
+// Print n bytes in cycles as bytes per cycle, to two places.
+static void
+report(char *what, uint64 n, uint64 cycles, uint64 bytecycles)
+{
+  uint64 r = cycles ? n * 100 / cycles : 0;
+  uint64 b = bytecycles ? n * 100 / bytecycles : 0;
+
+  printf("stringtest: %s %d.%d%d bytes/cycle (byte loop %d.%d%d)\n", what,
+         (int)(r / 100), (int)(r / 10 % 10), (int)(r % 10),
+         (int)(b / 100), (int)(b / 10 % 10), (int)(b % 10));
+}
+
+static void
+benchmark(void)
+{
+  uint64 t0, t1, t2;
+  int i;
+
+  t0 = r_cycle();
+  for(i = 0; i < NTIME; i++)
+    memmove(buf, ref, PGSIZE);
+  t1 = r_cycle();
+  for(i = 0; i < NTIME; i++)
+    bytemove(buf, ref, PGSIZE);
+  t2 = r_cycle();
+  report("memmove", (uint64)NTIME * PGSIZE, t1 - t0, t2 - t1);
+
+  t0 = r_cycle();
+  for(i = 0; i < NTIME; i++)
+    memset(buf, i, PGSIZE);
+  t1 = r_cycle();
+  for(i = 0; i < NTIME; i++)
+    byteset(buf, i, PGSIZE);
+  t2 = r_cycle();
+  report("memset", (uint64)NTIME * PGSIZE, t1 - t0, t2 - t1);
+
+  memmove(ref, buf, PGSIZE);
+  t0 = r_cycle();
+  for(i = 0; i < NTIME; i++)
+    if(memcmp(buf, ref, PGSIZE) != 0)
+      panic("stringtest: memcmp");
+  t1 = r_cycle();
+  for(i = 0; i < NTIME; i++){
+    if(bytecmp((uchar*)buf, (uchar*)ref, PGSIZE) != 0)
+      panic("stringtest: bytecmp");
+    __sync_synchronize();  // keep the compiler from hoisting it
+  }
+  t2 = r_cycle();
+  report("memcmp", (uint64)NTIME * PGSIZE, t1 - t0, t2 - t1);
+}
+
+void
+stringtest(void)
+{
+  if((buf = kalloc()) == 0 || (ref = kalloc()) == 0)
+    panic("stringtest: kalloc");
+  correctness();
+  printf("stringtest: memmove, memset, memcmp ok\n");
+  benchmark();
+  kfree(buf);
+  kfree(ref);
+}
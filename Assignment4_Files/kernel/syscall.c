@@ -102,6 +102,17 @@ extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
 extern uint64 sys_seek(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_fallocate(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_vmsplice(void);
+extern uint64 sys_splice(void);
+extern uint64 sys_dmesg(void);
+extern uint64 sys_ioctl(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -128,6 +139,17 @@ static uint64 (*syscalls[])(void) = {
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
 [SYS_seek]    sys_seek,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_fallocate] sys_fallocate,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_vmsplice] sys_vmsplice,
+[SYS_splice]  sys_splice,
+[SYS_dmesg]   sys_dmesg,
+[SYS_ioctl]   sys_ioctl,
 };
 
 void
@@ -21,4 +21,15 @@
 #define SYS_mkdir  20
 #define SYS_close  21
 #define SYS_seek   22
+#define SYS_pread  23
+#define SYS_pwrite 24
+#define SYS_readv  25
+#define SYS_writev 26
+#define SYS_fallocate 27
+#define SYS_mmap   28
+#define SYS_munmap 29
+#define SYS_vmsplice 30
+#define SYS_splice 31
+#define SYS_dmesg  32
+#define SYS_ioctl  33
 
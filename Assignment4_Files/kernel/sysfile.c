@@ -124,7 +124,7 @@ uint64
 sys_link(void)
 {
   char name[DIRSIZ], new[MAXPATH], old[MAXPATH];
-  struct inode *dp, *ip;
+  struct inode *dp, *ip, *big;
 
   if(argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0)
     return -1;
@@ -153,11 +153,14 @@ sys_link(void)
     iunlockput(dp);
     goto bad;
   }
+  big = dirhashdue(dp) ? idup(dp) : 0;
   iunlockput(dp);
   iput(ip);
 
   end_op();
 
+  if(big)
+    dirhashify(big);
   return 0;
 
 bad:
@@ -176,10 +179,12 @@ isdirempty(struct inode *dp)
   int off;
   struct dirent de;
 
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
+  // "." and ".." are not at the front of a hashed directory,
+  // so skip them by name.
+  for(off=0; off<dp->size; off+=sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("isdirempty: readi");
-    if(de.inum != 0)
+    if(de.inum != 0 && namecmp(de.name, ".") != 0 && namecmp(de.name, "..") != 0)
       return 0;
   }
   return 1;
@@ -189,7 +194,6 @@ uint64
 sys_unlink(void)
 {
   struct inode *ip, *dp;
-  struct dirent de;
   char name[DIRSIZ], path[MAXPATH];
   uint off;
 
@@ -219,9 +223,7 @@ sys_unlink(void)
     goto bad;
   }
 
-  memset(&de, 0, sizeof(de));
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-    panic("unlink: writei");
+  dirunlink(dp, name, off);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -242,12 +244,17 @@ bad:
   return -1;
 }
 
+// Create path, and return its i-node locked. If the directory
+// it was added to has grown enough to be hashed, set *pbig to
+// that directory, for the caller to pass to dirhashify() once
+// its transaction is over; otherwise set *pbig to 0.
 static struct inode*
-create(char *path, short type, short major, short minor)
+create(char *path, short type, short major, short minor, struct inode **pbig)
 {
   struct inode *ip, *dp;
   char name[DIRSIZ];
 
+  *pbig = 0;
   if((dp = nameiparent(path, name)) == 0)
     return 0;
 
@@ -262,7 +269,7 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0){
+  if((ip = ialloc(dp->dev, type, dp->inum)) == 0){
     iunlockput(dp);
     return 0;
   }
@@ -288,6 +295,8 @@ create(char *path, short type, short major, short minor)
     iupdate(dp);
   }
 
+  if(dirhashdue(dp))
+    *pbig = idup(dp);
   iunlockput(dp);
 
   return ip;
@@ -307,7 +316,7 @@ sys_open(void)
   char path[MAXPATH];
   int fd, omode;
   struct file *f;
-  struct inode *ip;
+  struct inode *ip, *big = 0;
   int n;
 
   argint(1, &omode);
@@ -317,7 +326,7 @@ sys_open(void)
   begin_op();
 
   if(omode & O_CREATE){
-    ip = create(path, T_FILE, 0, 0);
+    ip = create(path, T_FILE, 0, 0, &big);
     if(ip == 0){
       end_op();
       return -1;
@@ -345,8 +354,7 @@ sys_open(void)
     if(f)
       fileclose(f);
     iunlockput(ip);
-    end_op();
-    return -1;
+    goto bad;
   }
 
   if(ip->type == T_DEVICE){
@@ -357,9 +365,18 @@ sys_open(void)
     f->off = 0;
   }
   f->ip = ip;
+  f->nonblock = (omode & O_NONBLOCK) != 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
 
+  if(f->type == FD_DEVICE && devsw[f->major].open && devsw[f->major].open(f) < 0){
+    myproc()->ofile[fd] = 0;
+    f->type = FD_NONE;
+    fileclose(f);
+    iunlockput(ip);
+    goto bad;
+  }
+
   if((omode & O_TRUNC) && ip->type == T_FILE){
     itrunc(ip);
   }
@@ -367,29 +384,39 @@ sys_open(void)
   iunlock(ip);
   end_op();
 
+  if(big)
+    dirhashify(big);
   return fd;
+
+bad:
+  if(big)
+    iput(big);
+  end_op();
+  return -1;
 }
 
 uint64
 sys_mkdir(void)
 {
   char path[MAXPATH];
-  struct inode *ip;
+  struct inode *ip, *big;
 
   begin_op();
-  if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
+  if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0, &big)) == 0){
     end_op();
     return -1;
   }
   iunlockput(ip);
   end_op();
+  if(big)
+    dirhashify(big);
   return 0;
 }
 
 uint64
 sys_mknod(void)
 {
-  struct inode *ip;
+  struct inode *ip, *big;
   char path[MAXPATH];
   int major, minor;
 
@@ -397,12 +424,14 @@ sys_mknod(void)
   argint(1, &major);
   argint(2, &minor);
   if((argstr(0, path, MAXPATH)) < 0 ||
-     (ip = create(path, T_DEVICE, major, minor)) == 0){
+     (ip = create(path, T_DEVICE, major, minor, &big)) == 0){
     end_op();
     return -1;
   }
   iunlockput(ip);
   end_op();
+  if(big)
+    dirhashify(big);
   return 0;
 }
 
@@ -519,3 +548,171 @@ sys_seek(void){
 
   return fileseek(f, offset, whence);
 }
+
+// pread(fd, buf, n, off) and pwrite(fd, buf, n, off)
+// transfer at offset off without moving the fd's offset.
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || off < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || off < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
+
+// fallocate(fd, off, len) allocates the blocks of a
+// regular file's bytes [off, off+len).
+uint64
+sys_fallocate(void)
+{
+  struct file *f;
+  int off, len;
+
+  argint(1, &off);
+  argint(2, &len);
+  if(argfd(0, 0, &f) < 0 || off < 0 || len < 0)
+    return -1;
+  return fileallocate(f, off, len);
+}
+
+// Read or write each of the iovcnt buffers in the user's
+// iovec array in turn, stopping after a short transfer.
+// Returns the total number of bytes transferred.
+static int
+filerw_vec(int write)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int i, r, iovcnt, tot;
+  uint64 uiov;
+
+  argaddr(1, &uiov);
+  argint(2, &iovcnt);
+  if(argfd(0, 0, &f) < 0 || iovcnt < 0 || iovcnt > IOV_MAX)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, uiov, iovcnt*sizeof(iov[0])) < 0)
+    return -1;
+
+  tot = 0;
+  for(i = 0; i < iovcnt; i++){
+    if(iov[i].iov_len > 0x7fffffff - tot)
+      return -1;
+    if(write)
+      r = filewrite(f, (uint64)iov[i].iov_base, iov[i].iov_len);
+    else
+      r = fileread(f, (uint64)iov[i].iov_base, iov[i].iov_len);
+    if(r < 0)
+      return tot > 0 ? tot : -1;
+    tot += r;
+    if(r < iov[i].iov_len)
+      break;
+  }
+  return tot;
+}
+
+uint64
+sys_readv(void)
+{
+  return filerw_vec(0);
+}
+
+uint64
+sys_writev(void)
+{
+  return filerw_vec(1);
+}
+
+// mmap(addr, len, prot, flags, fd, off) maps len bytes of fd
+// at off, or anonymous memory if flags has MAP_ANONYMOUS,
+// at an address the kernel picks; addr must be 0.
+uint64
+sys_mmap(void)
+{
+  struct file *f = 0;
+  uint64 addr;
+  int len, prot, flags, off;
+
+  argaddr(0, &addr);
+  argint(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argint(5, &off);
+  if(addr != 0 || len <= 0 || off < 0)
+    return -1;
+  if((flags & MAP_ANONYMOUS) == 0 && argfd(4, 0, &f) < 0)
+    return -1;
+  return vmamap(myproc(), len, prot, flags, f, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr;
+  int len;
+
+  argaddr(0, &addr);
+  argint(1, &len);
+  if(len <= 0)
+    return -1;
+  return vmaunmap(myproc(), addr, len);
+}
+
+uint64
+sys_vmsplice(void)
+{
+  struct file *f;
+  uint64 addr;
+  int n;
+
+  argaddr(1, &addr);
+  argint(2, &n);
+  if(argfd(0, 0, &f) < 0 || n < 0)
+    return -1;
+  return filevmsplice(f, addr, n);
+}
+
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  argint(2, &n);
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || n < 0)
+    return -1;
+  return filesplice(in, out, n);
+}
+
+uint64
+sys_ioctl(void)
+{
+  struct file *f;
+  int req, arg;
+
+  argint(1, &req);
+  argint(2, &arg);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return fileioctl(f, req, arg);
+}
@@ -90,6 +90,20 @@ sys_uptime(void)
   return xticks;
 }
 
+// copy the most recent kernel log output to user space.
+uint64
+sys_dmesg(void)
+{
+  uint64 buf;
+  int n;
+
+  argaddr(0, &buf);
+  argint(1, &n);
+  if(n < 0)
+    return -1;
+  return klogread(buf, n);
+}
+
 
 // uint64
 // sys_seek(void)
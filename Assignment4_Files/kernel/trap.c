@@ -67,6 +67,10 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if((r_scause() == 13 || r_scause() == 15) &&
+            uvmfault(p, r_stval(), r_scause() == 15) == 0){
+    // load or store page fault: copy-on-write, lazy heap,
+    // or mapped region
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -167,6 +171,8 @@ clockintr()
   ticks++;
   wakeup(&ticks);
   release(&tickslock);
+
+  klogdrain();
 }
 
 // check if it's an external interrupt or software interrupt,
@@ -34,13 +34,14 @@
 #define LSR 5                 // line status register
 #define LSR_RX_READY (1<<0)   // input is waiting to be read from RHR
 #define LSR_TX_IDLE (1<<5)    // THR can accept another character to send
+#define TX_FIFO_SIZE 16       // bytes the transmit FIFO holds once LSR_TX_IDLE
 
 #define ReadReg(reg) (*(Reg(reg)))
 #define WriteReg(reg, v) (*(Reg(reg)) = (v))
 
 // the transmit output buffer.
 struct spinlock uart_tx_lock;
-#define UART_TX_BUF_SIZE 32
+#define UART_TX_BUF_SIZE 256
 char uart_tx_buf[UART_TX_BUF_SIZE];
 uint64 uart_tx_w; // write next to uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE]
 uint64 uart_tx_r; // read next from uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE]
@@ -104,6 +105,51 @@ uartputc(int c)
 }
 
 
+// add n bytes from buf to the output buffer under one
+// acquisition of uart_tx_lock, and tell the UART to start
+// sending. blocks while the output buffer is full, so like
+// uartputc() it's only suitable for use by write().
+void
+uartwrite(char *buf, int n)
+{
+  int i = 0;
+
+  acquire(&uart_tx_lock);
+
+  if(panicked){
+    for(;;)
+      ;
+  }
+  while(i < n){
+    while(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE){
+      // buffer is full.
+      // start sending and wait for space in the buffer.
+      uartstart();
+      sleep(&uart_tx_r, &uart_tx_lock);
+    }
+    while(i < n && uart_tx_w < uart_tx_r + UART_TX_BUF_SIZE)
+      uart_tx_buf[uart_tx_w++ % UART_TX_BUF_SIZE] = buf[i++];
+  }
+  uartstart();
+  release(&uart_tx_lock);
+}
+
+// add up to n bytes from buf to the output buffer without
+// waiting for space, for the kernel log's drain, which may
+// run in an interrupt. returns the number of bytes added.
+int
+uarttryput(char *buf, int n)
+{
+  int i;
+
+  acquire(&uart_tx_lock);
+  for(i = 0; i < n && uart_tx_w < uart_tx_r + UART_TX_BUF_SIZE; i++)
+    uart_tx_buf[uart_tx_w++ % UART_TX_BUF_SIZE] = buf[i];
+  uartstart();
+  release(&uart_tx_lock);
+  return i;
+}
+
 // alternate version of uartputc() that doesn't 
 // use interrupts, for use by kernel printf() and
 // to echo characters. it spins waiting for the uart's
@@ -126,34 +172,35 @@ uartputc_sync(int c)
   pop_off();
 }
 
-// if the UART is idle, and a character is waiting
-// in the transmit buffer, send it.
+// if the UART is idle, and characters are waiting
+// in the transmit buffer, send as many as its
+// transmit FIFO holds.
 // caller must hold uart_tx_lock.
 // called from both the top- and bottom-half.
 void
 uartstart()
 {
-  while(1){
-    if(uart_tx_w == uart_tx_r){
-      // transmit buffer is empty.
-      return;
-    }
-    
-    if((ReadReg(LSR) & LSR_TX_IDLE) == 0){
-      // the UART transmit holding register is full,
-      // so we cannot give it another byte.
-      // it will interrupt when it's ready for a new byte.
-      return;
-    }
-    
-    int c = uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE];
+  int i;
+
+  if(uart_tx_w == uart_tx_r){
+    // transmit buffer is empty.
+    return;
+  }
+
+  if((ReadReg(LSR) & LSR_TX_IDLE) == 0){
+    // the UART is still sending the last batch.
+    // it will interrupt when its FIFO is empty.
+    return;
+  }
+
+  // LSR_TX_IDLE means the whole FIFO is empty.
+  for(i = 0; i < TX_FIFO_SIZE && uart_tx_r != uart_tx_w; i++){
+    WriteReg(THR, uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE]);
     uart_tx_r += 1;
-    
-    // maybe uartputc() is waiting for space in the buffer.
-    wakeup(&uart_tx_r);
-    
-    WriteReg(THR, c);
   }
+
+  // maybe uartputc() or uartwrite() is waiting for space in the buffer.
+  wakeup(&uart_tx_r);
 }
 
 // read one input character from the UART.
@@ -187,4 +234,7 @@ uartintr(void)
   acquire(&uart_tx_lock);
   uartstart();
   release(&uart_tx_lock);
+
+  // and refill the buffer from the kernel log.
+  klogdrain();
 }
@@ -3,6 +3,8 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 
@@ -102,6 +104,30 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
   return &pagetable[PX(0, va)];
 }
 
+// Like walk(pagetable, va, 0), for loops over a range that
+// may be mostly unpopulated, such as a lazily grown heap: sets
+// *next to the next address worth looking at, past the whole
+// range of a missing page-table page if that is why there is
+// no PTE for va.
+static pte_t *
+walknext(pagetable_t pagetable, uint64 va, uint64 *next)
+{
+  pte_t *pte;
+  uint64 span;
+
+  for(int level = 2; level > 0; level--) {
+    pte = &pagetable[PX(level, va)];
+    if((*pte & PTE_V) == 0) {
+      span = 1L << PXSHIFT(level);
+      *next = (va & ~(span - 1)) + span;
+      return 0;
+    }
+    pagetable = (pagetable_t)PTE2PA(*pte);
+  }
+  *next = va + PGSIZE;
+  return &pagetable[PX(0, va)];
+}
+
 // Look up a virtual address, return the physical address,
 // or 0 if not mapped.
 // Can only be used to look up user pages.
@@ -165,22 +191,20 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never mapped are skipped.
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, next;
   pte_t *pte;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+  for(a = va; a < va + npages*PGSIZE; a = next){
+    if((pte = walknext(pagetable, a, &next)) == 0 || (*pte & PTE_V) == 0)
+      continue;  // heap page never touched (see uvmfault())
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -296,34 +320,45 @@ uvmfree(pagetable_t pagetable, uint64 sz)
   freewalk(pagetable);
 }
 
+// Map the page at va in old at the same address in new.
+// If cow is set and the page is writable, both mappings
+// become read-only and copy-on-write (see cowfault());
+// otherwise the page is shared as it is.
+// returns 0 on success, -1 on failure.
+int
+uvmshare(pagetable_t old, pagetable_t new, uint64 va, int cow)
+{
+  pte_t *pte;
+  uint64 pa;
+
+  if((pte = walk(old, va, 0)) == 0 || (*pte & PTE_V) == 0)
+    panic("uvmshare: page not present");
+  if(cow && (*pte & PTE_W))
+    *pte = (*pte & ~PTE_W) | PTE_COW;
+  pa = PTE2PA(*pte);
+  if(mappages(new, va, PGSIZE, pa, PTE_FLAGS(*pte)) != 0)
+    return -1;
+  kdup((void*)pa);
+  return 0;
+}
+
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Copies the page table, sharing the
+// physical memory copy-on-write.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
   pte_t *pte;
-  uint64 pa, i;
-  uint flags;
-  char *mem;
+  uint64 i, next;
 
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
-    pa = PTE2PA(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+  for(i = 0; i < sz; i = next){
+    if((pte = walknext(old, i, &next)) == 0 || (*pte & PTE_V) == 0)
+      continue;  // heap page never touched
+    if(uvmshare(old, new, i, 1) != 0)
       goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
-    }
   }
   return 0;
 
@@ -332,6 +367,64 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   return -1;
 }
 
+// Give the process a private, writable copy of the
+// copy-on-write page at va after a store to it.
+// Returns 0, or -1 if va is not copy-on-write or
+// memory ran out.
+static int
+cowfault(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  char *mem;
+
+  if(va >= MAXVA || (pte = walk(pagetable, va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return -1;
+  pa = PTE2PA(*pte);
+  if(krefcount((void*)pa) > 1){
+    // others still use the page
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, (char*)pa, PGSIZE);
+    *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+    kfree((void*)pa);
+  } else {
+    *pte = (*pte & ~PTE_COW) | PTE_W;
+  }
+  return 0;
+}
+
+// Handle a fault by p at user address va, a store if write
+// is set: copy a copy-on-write page, fill in a heap page that
+// sbrk() added but nothing has touched yet, or fault in a page
+// of a mapped region (see vmafault()).
+// Returns 0 if the access can now proceed, -1 if not.
+int
+uvmfault(struct proc *p, uint64 va, int write)
+{
+  pte_t *pte;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  pte = walk(p->pagetable, va, 0);
+  if(write && pte && (*pte & PTE_COW))
+    return cowfault(p->pagetable, va);
+  if(va < p->sz && (pte == 0 || (*pte & PTE_V) == 0)){
+    if((mem = kalloc()) == 0)
+      return -1;
+    memset(mem, 0, PGSIZE);
+    if(mappages(p->pagetable, PGROUNDDOWN(va), PGSIZE, (uint64)mem, PTE_R|PTE_W|PTE_U) != 0){
+      kfree(mem);
+      return -1;
+    }
+    return 0;
+  }
+  return vmafault(p, va, write);
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -345,6 +438,202 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// Lend p's page at page-aligned user address va, below p->sz,
+// to the kernel: the page becomes copy-on-write for p if it was
+// writable, and gains a reference that the caller must drop with
+// kfree(). Returns the page, or 0 if va is not such a page.
+char*
+uvmlend(struct proc *p, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+
+  if(va % PGSIZE != 0 || va + PGSIZE > p->sz)
+    return 0;
+  pte = walk(p->pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0){
+    if(uvmfault(p, va, 0) < 0)
+      return 0;
+    pte = walk(p->pagetable, va, 0);
+  }
+  if((*pte & PTE_U) == 0)
+    return 0;
+  if(*pte & PTE_W)
+    *pte = (*pte & ~PTE_W) | PTE_COW;
+  pa = PTE2PA(*pte);
+  kdup((void*)pa);
+  return (char*)pa;
+}
+
+// Map page pa copy-on-write at page-aligned user address va,
+// below p->sz, in place of p's writable page there, taking over
+// the caller's reference to pa. Returns 0, or -1 if va is not
+// such a page.
+int
+uvmgive(struct proc *p, uint64 va, char *pa)
+{
+  pte_t *pte;
+  uint64 old;
+
+  if(va % PGSIZE != 0 || va + PGSIZE > p->sz)
+    return -1;
+  pte = walk(p->pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0){
+    // heap page never touched
+    return mappages(p->pagetable, va, PGSIZE, (uint64)pa, PTE_R|PTE_U|PTE_COW);
+  }
+  if((*pte & PTE_U) == 0 || (*pte & (PTE_W|PTE_COW)) == 0)
+    return -1;
+  old = PTE2PA(*pte);
+  *pte = PA2PTE(pa) | (PTE_FLAGS(*pte) & ~PTE_W) | PTE_COW;
+  kfree((void*)old);
+  return 0;
+}
+
+// Forget p's cached translations, before its
+// page table is freed or replaced.
+void
+utlbflush(struct proc *p)
+{
+  int i;
+
+  for(i = 0; i < NUTLB; i++)
+    p->utlb[i].pte = 0;
+}
+
+// Like walk(pagetable, va, 0) for p's own page table, but
+// try p's few most recent translations first: system calls
+// tend to copy to and from the same pages again and again.
+static pte_t*
+utlbwalk(struct proc *p, uint64 va)
+{
+  struct utlb *t;
+  pte_t *pte;
+
+  for(t = p->utlb; t < &p->utlb[NUTLB]; t++)
+    if(t->pte && t->va == va)
+      return t->pte;
+  if((pte = walk(p->pagetable, va, 0)) != 0){
+    t = &p->utlb[p->utlbnext];
+    p->utlbnext = (p->utlbnext + 1) % NUTLB;
+    t->va = va;
+    t->pte = pte;
+  }
+  return pte;
+}
+
+// Look up the user page at va for copyout() (write) or copyin(),
+// letting uvmfault() copy or fill it in first if the current
+// process's own access would fault.
+// Returns the physical address, or 0.
+static uint64
+useraddr(pagetable_t pagetable, uint64 va, int write)
+{
+  pte_t *pte;
+  struct proc *p = myproc();
+
+  if(va >= MAXVA)
+    return 0;
+  if(p != 0 && p->pagetable == pagetable)
+    pte = utlbwalk(p, va);
+  else
+    pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 ||
+     (write && (*pte & PTE_W) == 0)){
+    if(p == 0 || p->pagetable != pagetable || uvmfault(p, va, write) < 0)
+      return 0;
+    pte = utlbwalk(p, va);
+  }
+  return PTE2PA(*pte);
+}
+
+// Fault in the pages of the current process's user range
+// [va, va+len) that a copy to it (if write is set) or from it
+// would fault on, so that the copy need not. Returns 0, or -1
+// if part of the range is not accessible.
+int
+uvmtouch(uint64 va, uint64 len, int write)
+{
+  pagetable_t pagetable = myproc()->pagetable;
+  uint64 a;
+
+  if(va + len < va)
+    return -1;
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE)
+    if(useraddr(pagetable, a, write) == 0)
+      return -1;
+  return 0;
+}
+
+// Start copying len bytes to (if write is set) or from the
+// current process's buffer at va, a user address if user is
+// set, a piece at a time with uspanout() or uspanin(). The
+// user pages are faulted in now, so that the copies, which
+// look up each page only once, need not sleep and may be made
+// while holding a spinlock. Returns 0, or -1 if the buffer is
+// not all accessible.
+int
+uspaninit(struct uspan *u, int user, uint64 va, uint64 len, int write)
+{
+  u->user = user;
+  u->write = write;
+  u->va = va;
+  u->end = va + len;
+  u->kva = user ? 0 : (char*)va;
+  if(!user)
+    return 0;
+  return uvmtouch(va, len, write);
+}
+
+// Copy n bytes between the next part of u and kernel
+// address k, into u if out is set.
+static int
+uspancopy(struct uspan *u, char *k, uint64 n, int out)
+{
+  uint64 m, pa;
+
+  if(n > u->end - u->va || (out && !u->write))
+    return -1;
+  while(n > 0){
+    if(u->kva == 0){
+      if((pa = useraddr(myproc()->pagetable, PGROUNDDOWN(u->va), u->write)) == 0)
+        return -1;
+      u->kva = (char*)pa + u->va % PGSIZE;
+    }
+    m = n;
+    if(u->user && m > PGSIZE - u->va % PGSIZE)
+      m = PGSIZE - u->va % PGSIZE;
+    if(out)
+      memmove(u->kva, k, m);
+    else
+      memmove(k, u->kva, m);
+    n -= m;
+    k += m;
+    u->va += m;
+    u->kva += m;
+    if(u->user && u->va % PGSIZE == 0)
+      u->kva = 0;  // on to the next page
+  }
+  return 0;
+}
+
+// Copy n bytes from src to the next part of u.
+// Returns 0, or -1 if u has no room or was not opened
+// for writing.
+int
+uspanout(struct uspan *u, void *src, uint64 n)
+{
+  return uspancopy(u, src, n, 1);
+}
+
+// Copy the next n bytes of u to dst.
+// Returns 0, or -1 if u has fewer bytes left.
+int
+uspanin(struct uspan *u, void *dst, uint64 n)
+{
+  return uspancopy(u, dst, n, 0);
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -355,7 +644,7 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = useraddr(pagetable, va0, 1);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
@@ -380,7 +669,7 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = useraddr(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -407,7 +696,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = useraddr(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -0,0 +1,409 @@
+//
+// Memory-mapped files and anonymous memory.
+//
+// mmap() only records a region (a VMA) in the process; pages
+// are filled in by vmafault() when the process first touches
+// them: zeroed for anonymous memory, read from the file for a
+// file mapping. Regions are placed top-down below the trapframe,
+// and the heap may not grow into them.
+//
+// MAP_SHARED anonymous memory is the exception: its pages are
+// allocated by mmap() itself, since a page first touched after
+// a fork() would otherwise be a separate one in each process.
+//
+// The pages of MAP_SHARED file mappings are kept in a page cache
+// keyed by (i-node, page number in the file), so that every
+// process mapping the file, with its own mmap() or by fork(),
+// maps the same physical page, and the file is read into it only
+// once. The cache holds one reference to the page (see kdup())
+// and each PTE mapping it another; the entry goes away with the
+// last PTE. Since a PTE only exists while its VMA holds the file
+// open, the entry needs no reference to the i-node of its own.
+//
+// A page of a MAP_SHARED file mapping is first mapped read-only.
+// The store fault that makes it writable also marks it as one to
+// write back to the file, through the log, when it is unmapped.
+// A MAP_PRIVATE page is the process's own copy of the file data,
+// and its changes are never written back. fork() shares MAP_SHARED
+// pages with the child and MAP_PRIVATE ones copy-on-write.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "stat.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
+#include "slab.h"
+
+#define NPCHASH 61  // hash buckets in the page cache
+
+struct fpage {
+  struct inode *ip;
+  uint pgno;          // page number in the file
+  char *pa;
+  struct fpage *next; // hash chain
+};
+
+static struct {
+  struct spinlock lock;  // protects the chains, and the page
+                         // references taken through them
+  struct kmem_cache cache;
+  struct fpage *hash[NPCHASH];
+} pcache;
+
+static void vmaunmap_pages(struct vma*, pagetable_t, uint64, uint64, int);
+
+void
+vmainit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  kmem_cache_init(&pcache.cache, "fpage", sizeof(struct fpage));
+}
+
+// The link to ip's page pgno in its hash chain, pointing to
+// 0 if the page is not cached. Caller must hold pcache.lock.
+static struct fpage**
+pcfind(struct inode *ip, uint pgno)
+{
+  struct fpage **pp;
+
+  pp = &pcache.hash[((uint64)ip / sizeof(*ip) + pgno) % NPCHASH];
+  for(; *pp; pp = &(*pp)->next)
+    if((*pp)->ip == ip && (*pp)->pgno == pgno)
+      break;
+  return pp;
+}
+
+// Return ip's page pgno, with a reference for the caller,
+// reading it from the file if it is not cached.
+// Returns 0 if out of memory.
+static char*
+pcget(struct inode *ip, uint pgno)
+{
+  struct fpage *fp, **pp;
+  char *mem, *pa;
+
+  acquire(&pcache.lock);
+  if((fp = *pcfind(ip, pgno)) != 0){
+    pa = fp->pa;
+    kdup(pa);
+    release(&pcache.lock);
+    return pa;
+  }
+  release(&pcache.lock);
+
+  if((mem = kalloc()) == 0)
+    return 0;
+  if((fp = kmem_cache_alloc(&pcache.cache)) == 0){
+    kfree(mem);
+    return 0;
+  }
+  memset(mem, 0, PGSIZE);
+  ilock(ip);
+  readi(ip, 0, (uint64)mem, pgno * PGSIZE, PGSIZE);
+  iunlock(ip);
+
+  acquire(&pcache.lock);
+  pp = pcfind(ip, pgno);
+  if(*pp){
+    // another process read it meanwhile.
+    pa = (*pp)->pa;
+    kdup(pa);
+    release(&pcache.lock);
+    kmem_cache_free(&pcache.cache, fp);
+    kfree(mem);
+    return pa;
+  }
+  fp->ip = ip;
+  fp->pgno = pgno;
+  fp->pa = mem;
+  fp->next = 0;
+  *pp = fp;
+  kdup(mem);  // the caller's; kalloc()'s is the cache's
+  release(&pcache.lock);
+  return mem;
+}
+
+// Drop the caller's reference to ip's cached page pgno at pa,
+// and the page itself if no PTE maps it any more.
+static void
+pcput(struct inode *ip, uint pgno, char *pa)
+{
+  struct fpage *fp = 0, **pp;
+
+  acquire(&pcache.lock);
+  kfree(pa);
+  pp = pcfind(ip, pgno);
+  if(*pp && (*pp)->pa == pa && krefcount(pa) == 1){
+    fp = *pp;
+    *pp = fp->next;
+  }
+  release(&pcache.lock);
+  if(fp){
+    kfree(fp->pa);
+    kmem_cache_free(&pcache.cache, fp);
+  }
+}
+
+// The VMA of p that contains va, or 0.
+static struct vma*
+vmafind(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len > 0 && va >= v->addr && va < v->addr + v->len)
+      return v;
+  return 0;
+}
+
+// The lowest address mapped by a VMA of p, or TRAPFRAME.
+uint64
+vmalow(struct proc *p)
+{
+  struct vma *v;
+  uint64 low = TRAPFRAME;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len > 0 && v->addr < low)
+      low = v->addr;
+  return low;
+}
+
+// Map len bytes of f at offset off, or anonymous memory if
+// f is 0, into p. Returns the address, or -1.
+uint64
+vmamap(struct proc *p, uint64 len, int prot, int flags, struct file *f, uint off)
+{
+  struct vma *v, *free = 0;
+  uint64 addr, va;
+
+  len = PGROUNDUP(len);
+  if(len == 0 || off % PGSIZE != 0)
+    return -1;
+  if((flags & (MAP_SHARED|MAP_PRIVATE)) == 0 || (prot & (PROT_READ|PROT_WRITE)) == 0)
+    return -1;
+  if(f){
+    if(f->type != FD_INODE || f->ip->type != T_FILE || !f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len == 0){
+      free = v;
+      break;
+    }
+  addr = vmalow(p) - len;
+  if(free == 0 || addr > vmalow(p) || addr < PGROUNDUP(p->sz))
+    return -1;
+
+  free->addr = addr;
+  free->len = len;
+  free->prot = prot;
+  free->flags = flags;
+  free->f = f ? filedup(f) : 0;
+  free->off = off;
+
+  if(f == 0 && (flags & MAP_SHARED)){
+    for(va = addr; va < addr + len; va += PGSIZE){
+      if(vmafault(p, va, 0) != 0){
+        vmaunmap_pages(free, p->pagetable, addr, va, 0);
+        free->len = 0;
+        return -1;
+      }
+    }
+  }
+  return addr;
+}
+
+// Write page va of shared file mapping v back to the file,
+// without extending the file.
+static void
+vmawriteback(struct vma *v, uint64 va, uint64 pa)
+{
+  struct inode *ip = v->f->ip;
+  uint off = v->off + (va - v->addr);
+  uint n;
+
+  begin_op();
+  ilock(ip);
+  if(off < ip->size){
+    n = ip->size - off < PGSIZE ? ip->size - off : PGSIZE;
+    writei(ip, 0, pa, off, n);
+  }
+  iunlock(ip);
+  end_op();
+}
+
+// Unmap the pages of v in [va, end) from pagetable, writing
+// back the ones a shared file mapping may have changed if
+// writeback is set, and free them.
+static void
+vmaunmap_pages(struct vma *v, pagetable_t pagetable, uint64 va, uint64 end, int writeback)
+{
+  pte_t *pte;
+  uint64 pa;
+
+  for(; va < end; va += PGSIZE){
+    if((pte = walk(pagetable, va, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;  // never touched
+    pa = PTE2PA(*pte);
+    if(v->f && (v->flags & MAP_SHARED)){
+      if(writeback && (*pte & PTE_W))
+        vmawriteback(v, va, pa);
+      pcput(v->f->ip, (v->off + (va - v->addr)) / PGSIZE, (char*)pa);
+    } else {
+      kfree((void*)pa);
+    }
+    *pte = 0;
+  }
+}
+
+// Unmap [addr, addr+len) from p. The range must be a whole
+// VMA or lie at its start or end.
+int
+vmaunmap(struct proc *p, uint64 addr, uint64 len)
+{
+  struct vma *v;
+
+  len = PGROUNDUP(len);
+  if(addr % PGSIZE != 0 || len == 0 || (v = vmafind(p, addr)) == 0)
+    return -1;
+  if(addr + len > v->addr + v->len)
+    return -1;
+  if(addr != v->addr && addr + len != v->addr + v->len)
+    return -1;  // would split v
+
+  vmaunmap_pages(v, p->pagetable, addr, addr + len, 1);
+  if(addr == v->addr){
+    v->addr += len;
+    v->off += len;
+  }
+  v->len -= len;
+  if(v->len == 0){
+    if(v->f)
+      fileclose(v->f);
+    v->f = 0;
+  }
+  return 0;
+}
+
+// Unmap all of p's VMAs from pagetable, which exec() may already
+// have replaced as p's page table.
+void
+vmaunmapall(struct proc *p, pagetable_t pagetable, int writeback)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0)
+      continue;
+    vmaunmap_pages(v, pagetable, v->addr, v->addr + v->len, writeback);
+    if(v->f)
+      fileclose(v->f);
+    v->f = 0;
+    v->len = 0;
+  }
+}
+
+// Give child np p's VMAs and the pages p has touched in
+// them: the same pages for MAP_SHARED, copy-on-write ones
+// for MAP_PRIVATE. Returns 0, or -1 if out of memory.
+int
+vmacopy(struct proc *p, struct proc *np)
+{
+  struct vma *v, *nv;
+  pte_t *pte;
+  uint64 va;
+
+  for(v = p->vma, nv = np->vma; v < &p->vma[NVMA]; v++, nv++){
+    if(v->len == 0)
+      continue;
+    *nv = *v;
+    if(nv->f)
+      filedup(nv->f);
+    for(va = v->addr; va < v->addr + v->len; va += PGSIZE){
+      if((pte = walk(p->pagetable, va, 0)) == 0 || (*pte & PTE_V) == 0)
+        continue;
+      if(uvmshare(p->pagetable, np->pagetable, va, (v->flags & MAP_SHARED) == 0) != 0)
+        goto err;
+    }
+  }
+  return 0;
+
+ err:
+  // p still holds the files, so this cannot sleep in iput().
+  vmaunmapall(np, np->pagetable, 0);
+  return -1;
+}
+
+// Handle a fault on user address va, a store if write is set,
+// by filling in the page if va lies in one of p's VMAs.
+// Returns 0 if the page is now mapped, -1 if the access is
+// not allowed or memory ran out.
+int
+vmafault(struct proc *p, uint64 va, int write)
+{
+  struct vma *v;
+  pte_t *pte;
+  char *mem;
+  int perm, shared;
+  uint pgno;
+
+  va = PGROUNDDOWN(va);
+  if((v = vmafind(p, va)) == 0)
+    return -1;
+  if(write && (v->prot & PROT_WRITE) == 0)
+    return -1;
+
+  // a store to a shared page mapped read-only so far
+  if((pte = walk(p->pagetable, va, 0)) != 0 && (*pte & PTE_V)){
+    if(!write || (*pte & PTE_COW))
+      return -1;
+    *pte |= PTE_W;
+    return 0;
+  }
+
+  // a read() or write() of this file to or from the mapping
+  // holds the lock already; they fault the pages in first
+  // (see inoderead()), so this is a bad address.
+  if(v->f && holdingsleep(&v->f->ip->lock))
+    return -1;
+
+  shared = v->f && (v->flags & MAP_SHARED);
+  pgno = (v->off + (va - v->addr)) / PGSIZE;
+  if(shared){
+    if((mem = pcget(v->f->ip, pgno)) == 0)
+      return -1;
+  } else {
+    if((mem = kalloc()) == 0)
+      return -1;
+    memset(mem, 0, PGSIZE);
+    if(v->f){
+      ilock(v->f->ip);
+      readi(v->f->ip, 0, (uint64)mem, pgno * PGSIZE, PGSIZE);
+      iunlock(v->f->ip);
+    }
+  }
+
+  perm = PTE_U | PTE_R;
+  if((v->prot & PROT_WRITE) && (write || !v->f || (v->flags & MAP_PRIVATE)))
+    perm |= PTE_W;
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    if(shared)
+      pcput(v->f->ip, pgno, mem);
+    else
+      kfree(mem);
+    return -1;
+  }
+  return 0;
+}
@@ -22,7 +22,7 @@
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = LOGBLOCKS;
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -31,6 +31,7 @@ struct superblock sb;
 char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
+int nbuckets;  // hash the root directory into this many blocks (-h)
 
 
 void balloc(int);
@@ -39,7 +40,9 @@ void winode(uint, struct dinode*);
 void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
+uint bmap(struct dinode *din, uint fbn);
 void iappend(uint inum, void *p, int n);
+void diradd(uint dir, char *name, uint inum);
 void die(const char *);
 
 // convert to riscv byte order
@@ -70,15 +73,21 @@ main(int argc, char *argv[])
 {
   int i, cc, fd;
   uint rootino, inum, off;
-  struct dirent de;
   char buf[BSIZE];
   struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  if(argc > 2 && strcmp(argv[1], "-h") == 0){
+    nbuckets = atoi(argv[2]);
+    assert(nbuckets >= 0 && nbuckets <= NDIRECT + NINDIRECT);
+    argc -= 2;
+    argv += 2;
+  }
+
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-h nbuckets] fs.img files...\n");
     exit(1);
   }
 
@@ -117,15 +126,17 @@ main(int argc, char *argv[])
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
+  if(nbuckets > 0){
+    // a hashed directory starts with its empty buckets
+    for(i = 0; i < nbuckets; i++)
+      iappend(rootino, zeroes, BSIZE);
+    rinode(rootino, &din);
+    din.major = xshort(nbuckets);
+    winode(rootino, &din);
+  }
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  diradd(rootino, ".", rootino);
+  diradd(rootino, "..", rootino);
 
   for(i = 2; i < argc; i++){
     // get rid of "user/"
@@ -148,11 +159,7 @@ main(int argc, char *argv[])
       shortname += 1;
 
     inum = ialloc(T_FILE);
-
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    diradd(rootino, shortname, inum);
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -161,11 +168,13 @@ main(int argc, char *argv[])
   }
 
   // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  if(nbuckets == 0){
+    rinode(rootino, &din);
+    off = xint(din.size);
+    off = ((off + BSIZE - 1) / BSIZE) * BSIZE;
+    din.size = xint(off);
+    winode(rootino, &din);
+  }
 
   balloc(freeblock);
 
@@ -249,6 +258,48 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the disk block holding block fbn of din,
+// allocating it and any indirect blocks on the way.
+uint
+bmap(struct dinode *din, uint fbn)
+{
+  uint indirect[NINDIRECT];
+  uint addr, span, idx;
+  int level;
+
+  if(fbn < NDIRECT){
+    if(xint(din->addrs[fbn]) == 0)
+      din->addrs[fbn] = xint(freeblock++);
+    return xint(din->addrs[fbn]);
+  }
+  fbn -= NDIRECT;
+  if(fbn < NINDIRECT){
+    level = 1;
+    span = 1;
+  } else if((fbn -= NINDIRECT) < NDINDIRECT){
+    level = 2;
+    span = NINDIRECT;
+  } else {
+    fbn -= NDINDIRECT;
+    level = 3;
+    span = NDINDIRECT;
+  }
+
+  if(xint(din->addrs[NDIRECT+level-1]) == 0)
+    din->addrs[NDIRECT+level-1] = xint(freeblock++);
+  addr = xint(din->addrs[NDIRECT+level-1]);
+  for(; level > 0; level--, span /= NINDIRECT){
+    rsect(addr, (char*)indirect);
+    idx = (fbn / span) % NINDIRECT;
+    if(indirect[idx] == 0){
+      indirect[idx] = xint(freeblock++);
+      wsect(addr, (char*)indirect);
+    }
+    addr = xint(indirect[idx]);
+  }
+  return addr;
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -256,7 +307,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -265,22 +315,7 @@ iappend(uint inum, void *xp, int n)
   while(n > 0){
     fbn = off / BSIZE;
     assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    x = bmap(&din, fbn);
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
     bcopy(p, buf + off - (fbn * BSIZE), n1);
@@ -293,6 +328,35 @@ iappend(uint inum, void *xp, int n)
   winode(inum, &din);
 }
 
+// Add an entry to directory dir: into a free slot of the
+// name's bucket if the directory is hashed, else at the end.
+void
+diradd(uint dir, char *name, uint inum)
+{
+  struct dirent de, *dp;
+  struct dinode din;
+  char buf[BSIZE];
+  uint x;
+
+  bzero(&de, sizeof(de));
+  de.inum = xshort(inum);
+  strncpy(de.name, name, DIRSIZ);
+
+  if(nbuckets > 0){
+    rinode(dir, &din);
+    x = bmap(&din, dirhash(de.name) % nbuckets);
+    rsect(x, buf);
+    for(dp = (struct dirent*)buf; dp < (struct dirent*)(buf + BSIZE); dp++){
+      if(dp->inum == 0){
+        *dp = de;
+        wsect(x, buf);
+        return;
+      }
+    }
+  }
+  iappend(dir, &de, sizeof(de));
+}
+
 void
 die(const char *s)
 {
@@ -0,0 +1,27 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// more than all the CPUs' log rings hold.
+#define BUFSZ (64*1024)
+
+int
+main(int argc, char *argv[])
+{
+  char *buf;
+  int n;
+
+  if((buf = malloc(BUFSZ)) == 0){
+    fprintf(2, "dmesg: out of memory\n");
+    exit(1);
+  }
+  if((n = dmesg(buf, BUFSZ)) < 0){
+    fprintf(2, "dmesg: failed\n");
+    exit(1);
+  }
+  if(write(1, buf, n) != n){
+    fprintf(2, "dmesg: write error\n");
+    exit(1);
+  }
+  exit(0);
+}
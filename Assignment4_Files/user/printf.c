@@ -6,14 +6,36 @@
 
 static char digits[] = "0123456789ABCDEF";
 
+// Output is collected in a buffer for the length of one
+// printf() call and written with one write() when the buffer
+// fills and when the call ends, rather than one per character.
+// Nothing is held between calls, so output still interleaves
+// correctly with write() and with other processes, and there
+// is nothing to lose at exit() or to duplicate at fork().
+struct outbuf {
+  int fd;
+  int n;
+  char buf[128];
+};
+
+static void
+flush(struct outbuf *o)
+{
+  if(o->n > 0)
+    write(o->fd, o->buf, o->n);
+  o->n = 0;
+}
+
 static void
-putc(int fd, char c)
+putc(struct outbuf *o, char c)
 {
-  write(fd, &c, 1);
+  o->buf[o->n++] = c;
+  if(o->n == sizeof(o->buf))
+    flush(o);
 }
 
 static void
-printint(int fd, int xx, int base, int sgn)
+printint(struct outbuf *o, int xx, int base, int sgn)
 {
   char buf[16];
   int i, neg;
@@ -35,16 +57,16 @@ printint(int fd, int xx, int base, int sgn)
     buf[i++] = '-';
 
   while(--i >= 0)
-    putc(fd, buf[i]);
+    putc(o, buf[i]);
 }
 
 static void
-printptr(int fd, uint64 x) {
+printptr(struct outbuf *o, uint64 x) {
   int i;
-  putc(fd, '0');
-  putc(fd, 'x');
+  putc(o, '0');
+  putc(o, 'x');
   for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
-    putc(fd, digits[x >> (sizeof(uint64) * 8 - 4)]);
+    putc(o, digits[x >> (sizeof(uint64) * 8 - 4)]);
 }
 
 // Print to the given fd. Only understands %d, %x, %p, %s.
@@ -53,7 +75,10 @@ vprintf(int fd, const char *fmt, va_list ap)
 {
   char *s;
   int c, i, state;
+  struct outbuf ob, *o = &ob;
 
+  o->fd = fd;
+  o->n = 0;
   state = 0;
   for(i = 0; fmt[i]; i++){
     c = fmt[i] & 0xff;
@@ -61,37 +86,38 @@ vprintf(int fd, const char *fmt, va_list ap)
       if(c == '%'){
         state = '%';
       } else {
-        putc(fd, c);
+        putc(o, c);
       }
     } else if(state == '%'){
       if(c == 'd'){
-        printint(fd, va_arg(ap, int), 10, 1);
+        printint(o, va_arg(ap, int), 10, 1);
       } else if(c == 'l') {
-        printint(fd, va_arg(ap, uint64), 10, 0);
+        printint(o, va_arg(ap, uint64), 10, 0);
       } else if(c == 'x') {
-        printint(fd, va_arg(ap, int), 16, 0);
+        printint(o, va_arg(ap, int), 16, 0);
       } else if(c == 'p') {
-        printptr(fd, va_arg(ap, uint64));
+        printptr(o, va_arg(ap, uint64));
       } else if(c == 's'){
         s = va_arg(ap, char*);
         if(s == 0)
           s = "(null)";
         while(*s != 0){
-          putc(fd, *s);
+          putc(o, *s);
           s++;
         }
       } else if(c == 'c'){
-        putc(fd, va_arg(ap, uint));
+        putc(o, va_arg(ap, uint));
       } else if(c == '%'){
-        putc(fd, c);
+        putc(o, c);
       } else {
         // Unknown % sequence.  Print it to draw attention.
-        putc(fd, '%');
-        putc(fd, c);
+        putc(o, '%');
+        putc(o, c);
       }
       state = 0;
     }
   }
+  flush(o);
 }
 
 void
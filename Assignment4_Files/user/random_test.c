@@ -86,6 +86,92 @@ test_continuity(int fd)
   return 1;
 }
 
+// Checks that one large read returns the same bytes as reading
+// them one at a time would, across several cycles of the PRG
+int
+test_bulk_read(int fd)
+{
+  static uint8 buf[1000];
+  uint8 prev;
+  if (read(fd, &prev, 1) != 1)
+    return 0;
+  if (read(fd, buf, sizeof(buf)) != sizeof(buf))
+    return 0;
+
+  for(int i = 0; i < sizeof(buf); i++)
+  {
+    prev = lfsr_char(prev);
+    if (buf[i] != prev)
+      return 0;
+  }
+
+  if (read(fd, buf, 1) != 1 || buf[0] != lfsr_char(prev))
+    return 0;
+
+  return 1;
+}
+
+// Checks that files given the same 8-byte seed read the same
+// stream of their own, in this process and in a child, without
+// disturbing the shared stream, and that a zero seed returns a
+// file to the shared stream
+int
+test_file_streams(int fd)
+{
+  static uint8 a[100], b[100];
+  uint64 seed = 0x0123456789abcdefULL, zero = 0;
+  uint8 prev, res;
+  int fd1, fd2, status;
+
+  if (read(fd, &prev, 1) != 1)
+    return 0;
+  if ((fd1 = open("random", O_RDWR)) < 0)
+    return 0;
+  if ((fd2 = open("random", O_RDWR)) < 0)
+    return 0;
+  if (write(fd1, &seed, 8) != 8 || write(fd2, &seed, 8) != 8)
+    return 0;
+  if (read(fd1, a, sizeof(a)) != sizeof(a) || read(fd2, b, sizeof(b)) != sizeof(b))
+    return 0;
+  if (memcmp(a, b, sizeof(a)) != 0)
+    return 0;
+
+  // the stream must not depend on how the reads are sized
+  if (write(fd2, &seed, 8) != 8 || read(fd2, b, 3) != 3 ||
+      read(fd2, b + 3, 5) != 5 || read(fd2, b + 8, 1) != 1 ||
+      read(fd2, b + 9, sizeof(b) - 9) != sizeof(b) - 9)
+    return 0;
+  if (memcmp(a, b, sizeof(a)) != 0)
+    return 0;
+
+  // a bad buffer is an error, not a short read
+  if (read(fd2, (void *)0x3000000000ULL, 8) != -1)
+    return 0;
+
+  if (fork() == 0)
+  {
+    int fd3 = open("random", O_RDWR);
+    if (fd3 < 0 || write(fd3, &seed, 8) != 8 || read(fd3, b, sizeof(b)) != sizeof(b))
+      exit(1);
+    exit(memcmp(a, b, sizeof(a)) != 0);
+  }
+  wait(&status);
+  if (status != 0)
+    return 0;
+
+  if (read(fd, &res, 1) != 1 || res != lfsr_char(prev))
+    return 0;
+
+  if (write(fd1, &zero, 8) != 8)
+    return 0;
+  if (read(fd1, &prev, 1) != 1 || prev != lfsr_char(res))
+    return 0;
+
+  close(fd1);
+  close(fd2);
+  return 1;
+}
+
 // Checks whether multiple processes generating with the same PRG
 // result in the proper amount of calls generated with correct values.
 int
@@ -248,6 +334,20 @@ test_random(int print)
   }
   if (print) printf("SUCCESS: Passed continuity test to continue generating seed from point before closing the device\n");
 
+  if (test_bulk_read(fd) == 0)
+  {
+    handleFailure("ERROR: Failed reading many values at once", fd);
+    return 0;
+  }
+  if (print) printf("SUCCESS: Passed reading many values at once\n");
+
+  if (test_file_streams(fd) == 0)
+  {
+    handleFailure("ERROR: Failed reading per-file streams", fd);
+    return 0;
+  }
+  if (print) printf("SUCCESS: Passed reading per-file streams\n");
+
   if (test_concurrency_read(fd) == 0)
   {
     handleFailure("ERROR: Failed reading proper values concurrently", fd);
@@ -5,6 +5,9 @@
 #include "kernel/fcntl.h"
 #endif
 
+// end of the file after test_write_2
+#define HOLE_START (sizeof("Hello, World!\n") + 50 + sizeof("This is new data!\n"))
+
 int
 test_write(int fd, int offset, int whence, char* toWrite, int length)
 {
@@ -73,17 +76,19 @@ test_write_1(int fd)
   return 1;
 }
 
-// Writes data to the end of the file, note that this test is using SEEK_CUR and checks 
-// too large and negative offsets
+// Writes data 50 bytes past the end of the file using SEEK_CUR, and checks that
+// the hole left in between reads as zeros
 int
 test_write_2(int fd)
 {
   char toWrite[] = "This is new data!\n";
-  char expected[] = "Hello, World!\n\0This is new data!\n";
+  char expected[50 + sizeof(toWrite)];
+  memset(expected, 0, 50);
+  memmove(expected + 50, toWrite, sizeof(toWrite));
   if (test_write(fd, 50, SEEK_CUR, toWrite, sizeof(toWrite)) == 0)
     return 0;
   
-  if (test_read(fd, -50, SEEK_CUR, expected, sizeof(expected)) == 0)
+  if (test_read(fd, -(int)sizeof(expected), SEEK_CUR, expected, sizeof(expected)) == 0)
     return -1;
   
   return 1;
@@ -97,16 +102,21 @@ test_read_1(int fd)
   return test_read(fd, -5, SEEK_CUR, expected, sizeof(expected));
 }
 
-// Writes data to the end of the file, this test uses SEEK_SET to check too large and negative offsets
+// Writes data at offset 500, past the end of the file, using SEEK_SET, checks the hole
+// before it, that SEEK_END finds the new end and that negative offsets clamp to 0
 int
 test_write_3(int fd)
 {
   char toWrite[] = "Extra fresh data!\n";
-  char expected[] = "Hello, World!\n\0This is new data!\n\0Extra fresh data!\n";
+  char expected[500 - HOLE_START + sizeof(toWrite)];
+  memset(expected, 0, 500 - HOLE_START);
+  memmove(expected + 500 - HOLE_START, toWrite, sizeof(toWrite));
   if (test_write(fd, 500, SEEK_SET, toWrite, sizeof(toWrite)) == 0)
     return 0;
   
-  if (test_read(fd, -500, SEEK_SET, expected, sizeof(expected)) == 0)
+  if (test_read(fd, HOLE_START, SEEK_SET, expected, sizeof(expected)) == 0)
+    return -1;
+  if (seek(fd, 0, SEEK_END) != 500 + sizeof(toWrite) || seek(fd, -500, SEEK_SET) != 0)
     return -1;
   
   return 1;
@@ -115,8 +125,6 @@ test_write_3(int fd)
 int 
 test_seek(int print) {
   char expected1[] = "Hello, World!\n";
-  char expected2[] = "Hello, World!\n\0This is new data!\n";
-  char expected3[] = "Hello, World!\n\0This is new data!\n\0Extra fresh data!\n";
 
   int fd = openTestFile();
   if (fd == 0)
@@ -144,8 +152,8 @@ test_seek(int print) {
     print_file_contents(fd, sizeof(expected1), "Content of the txt file after the first write:");
 
   // Second test: write "This is new data!\n" to the end of the file, then read to make sure it was received successfully
-  // This test checks whether going too far forward (f->off + offset > file size) or too far back (f->off + offset < 0)
-  // With WHENCE = SEEK_CUR
+  // This test checks that going past the end of the file (f->off + offset > file size) with WHENCE = SEEK_CUR
+  // leaves a hole that reads as zeros
   int res2;
   if ((res2 = test_write_2(fd)) == 1)
   {
@@ -161,7 +169,7 @@ test_seek(int print) {
   }
 
   if (print)
-    print_file_contents(fd, sizeof(expected2), "Content of the txt file after the second write:");
+    print_file_contents(fd, HOLE_START, "Content of the txt file after the second write:");
 
   // Third test: Go back 5 characters and read until the end of the file
   // This test checks whether SEEK_CUR with negative offset brings the file to the correct offset
@@ -176,8 +184,8 @@ test_seek(int print) {
   }
 
   // Fourth test: write "Extra fresh data!\n" to the end of the file, then read to make sure it was received successfully
-  // This test checks whether going too far forward (offset > file size) or too far back (offset < 0)
-  // with WHENCE = SEEK_SET
+  // This test checks going past the end of the file (offset > file size) and too far back (offset < 0)
+  // with WHENCE = SEEK_SET, and SEEK_END
   int res3;
   if ((res3 = test_write_3(fd)) == 1)
   {
@@ -193,7 +201,7 @@ test_seek(int print) {
   }
 
   if (print)
-    print_file_contents(fd, sizeof(expected3), "Content of the txt file after the third write:");
+    print_file_contents(fd, 500 + sizeof("Extra fresh data!\n"), "Content of the txt file after the third write:");
 
   printf("SUCCESS!! PASSED SEEK TETSTS\n");
   close(fd);
@@ -3,6 +3,14 @@
 #include "kernel/fcntl.h"
 #include "user/user.h"
 
+// memset, memmove, memcmp and strlen work a 64-bit word at a
+// time once the addresses are aligned, with byte loops for the
+// unaligned head and tail.
+#define WSIZE sizeof(uint64)
+#define WMASK (WSIZE - 1)
+#define ONES  0x0101010101010101UL
+#define HIGHS 0x8080808080808080UL
+
 //
 // wrapper so that it's OK if main() does not call exit().
 //
@@ -36,21 +44,40 @@ strcmp(const char *p, const char *q)
 uint
 strlen(const char *s)
 {
-  int n;
-
-  for(n = 0; s[n]; n++)
+  const char *p = s;
+  const uint64 *w;
+
+  for(; (uint64)p & WMASK; p++)
+    if(*p == 0)
+      return p - s;
+  // stop at the first word with a zero byte in it.
+  for(w = (const uint64 *) p; ((*w - ONES) & ~*w & HIGHS) == 0; w++)
     ;
-  return n;
+  for(p = (const char *) w; *p; p++)
+    ;
+  return p - s;
 }
 
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 w, *wdst;
+
+  for(; n > 0 && ((uint64)cdst & WMASK); n--)
+    *cdst++ = c;
+  if(n >= WSIZE){
+    w = (uchar)c * ONES;
+    wdst = (uint64 *) cdst;
+    for(; n >= 4*WSIZE; n -= 4*WSIZE, wdst += 4){
+      wdst[0] = w; wdst[1] = w; wdst[2] = w; wdst[3] = w;
+    }
+    for(; n >= WSIZE; n -= WSIZE)
+      *wdst++ = w;
+    cdst = (char *) wdst;
   }
+  for(; n > 0; n--)
+    *cdst++ = c;
   return dst;
 }
 
@@ -111,15 +138,41 @@ memmove(void *vdst, const void *vsrc, int n)
 {
   char *dst;
   const char *src;
+  uint64 *wdst;
+  const uint64 *wsrc;
+  int aligned;
 
+  if(n <= 0)
+    return vdst;
   dst = vdst;
   src = vsrc;
+  aligned = (((uint64)dst ^ (uint64)src) & WMASK) == 0;
   if (src > dst) {
+    if(aligned){
+      for(; n > 0 && ((uint64)dst & WMASK); n--)
+        *dst++ = *src++;
+      wdst = (uint64 *) dst;
+      wsrc = (const uint64 *) src;
+      for(; n >= WSIZE; n -= WSIZE)
+        *wdst++ = *wsrc++;
+      dst = (char *) wdst;
+      src = (const char *) wsrc;
+    }
     while(n-- > 0)
       *dst++ = *src++;
   } else {
     dst += n;
     src += n;
+    if(aligned){
+      for(; n > 0 && ((uint64)dst & WMASK); n--)
+        *--dst = *--src;
+      wdst = (uint64 *) dst;
+      wsrc = (const uint64 *) src;
+      for(; n >= WSIZE; n -= WSIZE)
+        *--wdst = *--wsrc;
+      dst = (char *) wdst;
+      src = (const char *) wsrc;
+    }
     while(n-- > 0)
       *--dst = *--src;
   }
@@ -129,7 +182,21 @@ memmove(void *vdst, const void *vsrc, int n)
 int
 memcmp(const void *s1, const void *s2, uint n)
 {
-  const char *p1 = s1, *p2 = s2;
+  const uchar *p1 = s1, *p2 = s2;
+  const uint64 *w1, *w2;
+
+  if((((uint64)p1 ^ (uint64)p2) & WMASK) == 0){
+    for(; n > 0 && ((uint64)p1 & WMASK); n--, p1++, p2++)
+      if(*p1 != *p2)
+        return *p1 - *p2;
+    // skip equal words; the byte loop finds the difference.
+    w1 = (const uint64 *) p1;
+    w2 = (const uint64 *) p2;
+    for(; n >= WSIZE && *w1 == *w2; n -= WSIZE)
+      w1++, w2++;
+    p1 = (const uchar *) w1;
+    p2 = (const uchar *) w2;
+  }
   while (n-- > 0) {
     if (*p1 != *p2) {
       return *p1 - *p2;
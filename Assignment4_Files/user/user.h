@@ -1,4 +1,5 @@
 struct stat;
+struct iovec;
 
 // system calls
 int fork(void);
@@ -23,6 +24,17 @@ char* sbrk(int);
 int sleep(int);
 int uptime(void);
 int seek(int, int, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int fallocate(int, int, int);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int vmsplice(int, const void*, int);
+int splice(int, int, int);
+int dmesg(char*, int);
+int ioctl(int, int, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
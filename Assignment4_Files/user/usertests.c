@@ -575,6 +575,10 @@ writetest(char *s)
   }
 }
 
+// big enough to need the double-indirect block,
+// yet well within the disk.
+#define NBIG (NDIRECT + NINDIRECT + 2*NINDIRECT)
+
 void
 writebig(char *s)
 {
@@ -586,7 +590,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < NBIG; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed\n", s, i);
@@ -606,7 +610,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != NBIG){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -675,6 +679,658 @@ void dirtest(char *s)
   }
 }
 
+// the name lookup cache must forget misses when a name is created,
+// hits when it is unlinked, and all names of a freed directory.
+void
+dcachetest(char *s)
+{
+  int fd;
+
+  if(mkdir("dcd") < 0){
+    printf("%s: mkdir failed\n", s);
+    exit(1);
+  }
+  if(open("dcd/x", O_RDONLY) >= 0){
+    printf("%s: open of missing file succeeded\n", s);
+    exit(1);
+  }
+  if((fd = open("dcd/x", O_CREATE|O_RDWR)) < 0){
+    printf("%s: create after miss failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if((fd = open("dcd/x", O_RDONLY)) < 0){
+    printf("%s: open after create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(unlink("dcd/x") < 0 || unlink("dcd") < 0){
+    printf("%s: unlink failed\n", s);
+    exit(1);
+  }
+  if(open("dcd/x", O_RDONLY) >= 0){
+    printf("%s: open after unlink succeeded\n", s);
+    exit(1);
+  }
+  // likely reuses dcd's inode
+  if(mkdir("dce") < 0){
+    printf("%s: mkdir dce failed\n", s);
+    exit(1);
+  }
+  if(open("dce/x", O_RDONLY) >= 0){
+    printf("%s: stale entry in new directory\n", s);
+    exit(1);
+  }
+  unlink("dce");
+}
+
+// a directory made at run time is converted to a hashed one
+// once it has a few hundred entries; every name must still be
+// found, and unlinked, in it.
+void
+hashdirtest(char *s)
+{
+  enum { N = 300 };
+  int i, fd;
+  char name[16];
+
+  if(mkdir("hd") < 0 || (fd = open("hd/f", O_CREATE|O_RDWR)) < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  strcpy(name, "hd/xx");
+  for(i = 0; i < N; i++){
+    name[3] = 'a' + i / 26;
+    name[4] = 'a' + i % 26;
+    if(link("hd/f", name) != 0){
+      printf("%s: link %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    name[3] = 'a' + i / 26;
+    name[4] = 'a' + i % 26;
+    if((fd = open(name, O_RDONLY)) < 0){
+      printf("%s: open %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+    if(unlink(name) != 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("hd") == 0){
+    printf("%s: unlinked non-empty directory\n", s);
+    exit(1);
+  }
+  if(unlink("hd/f") != 0 || unlink("hd") != 0){
+    printf("%s: unlink hd failed\n", s);
+    exit(1);
+  }
+}
+
+// pread/pwrite at explicit offsets, seek's return value,
+// and vectored readv/writev.
+void
+preadwrite(char *s)
+{
+  int fd;
+  char buf[16], a[4], b[6];
+  struct iovec iov[2];
+
+  unlink("prw");
+  fd = open("prw", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  iov[0].iov_base = "abcd";
+  iov[0].iov_len = 4;
+  iov[1].iov_base = "efghij";
+  iov[1].iov_len = 6;
+  if(writev(fd, iov, 2) != 10){
+    printf("%s: writev failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "XY", 2, 2) != 2 || seek(fd, 0, SEEK_CUR) != 10){
+    printf("%s: pwrite moved the offset\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, 4, 1) != 4 || memcmp(buf, "bXYe", 4) != 0){
+    printf("%s: pread returned wrong data\n", s);
+    exit(1);
+  }
+  if(seek(fd, -4, SEEK_END) != 6 || seek(fd, 0, SEEK_SET) != 0){
+    printf("%s: seek returned wrong offset\n", s);
+    exit(1);
+  }
+  iov[0].iov_base = a;
+  iov[0].iov_len = sizeof(a);
+  iov[1].iov_base = b;
+  iov[1].iov_len = sizeof(b);
+  if(readv(fd, iov, 2) != 10 || memcmp(a, "abXY", 4) != 0 || memcmp(b, "efghij", 6) != 0){
+    printf("%s: readv returned wrong data\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("prw");
+}
+
+// writing past the end leaves a hole that reads as zeros,
+// also once fallocate() has given it blocks.
+void
+sparse(char *s)
+{
+  int fd, i, off;
+  char buf[512];
+  struct stat st;
+
+  unlink("sparse");
+  fd = open("sparse", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  if(seek(fd, 100000, SEEK_SET) != 100000 || write(fd, "x", 1) != 1){
+    printf("%s: write past end failed\n", s);
+    exit(1);
+  }
+  if(fstat(fd, &st) < 0 || st.size != 100001){
+    printf("%s: wrong size\n", s);
+    exit(1);
+  }
+  // fill the hole inside the file and reserve blocks past its end,
+  // then write past those, so they become part of the file.
+  if(fallocate(fd, 0, 200000) < 0 || pwrite(fd, "y", 1, 300000) != 1){
+    printf("%s: fallocate failed\n", s);
+    exit(1);
+  }
+  for(off = 0; off < 300000; off += 50000){
+    if(pread(fd, buf, sizeof(buf), off + 5000) != sizeof(buf)){
+      printf("%s: pread failed\n", s);
+      exit(1);
+    }
+    for(i = 0; i < sizeof(buf); i++){
+      if(buf[i] != 0){
+        printf("%s: hole at %d is not zero\n", s, off + 5000 + i);
+        exit(1);
+      }
+    }
+  }
+  if(pread(fd, buf, 2, 100000) != 2 || buf[0] != 'x' || buf[1] != 0){
+    printf("%s: data around hole wrong\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("sparse");
+}
+
+// a write far past the end reaches the triple-indirect block,
+// allocating only the indirect blocks on the way to it.
+void
+hugesparse(char *s)
+{
+  int fd, off, off2;
+  char buf[4];
+  struct stat st;
+
+  off = (NDIRECT + NINDIRECT + NDINDIRECT + 5) * BSIZE + 7;
+  off2 = off + NDINDIRECT * BSIZE;  // under another double-indirect block
+  unlink("hugesparse");
+  fd = open("hugesparse", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "ab", 2, off) != 2 || pwrite(fd, "cd", 2, off2) != 2){
+    printf("%s: write past triple-indirect failed\n", s);
+    exit(1);
+  }
+  if(fstat(fd, &st) < 0 || st.size != off2 + 2){
+    printf("%s: wrong size\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, 4, off - 1) != 4 || buf[0] != 0 || buf[1] != 'a' ||
+     buf[2] != 'b' || buf[3] != 0){
+    printf("%s: wrong data at %d\n", s, off);
+    exit(1);
+  }
+  if(pread(fd, buf, 2, off2) != 2 || buf[0] != 'c' || buf[1] != 'd'){
+    printf("%s: wrong data at %d\n", s, off2);
+    exit(1);
+  }
+  if(pread(fd, buf, 4, (NDIRECT + NINDIRECT + 100) * BSIZE) != 4 ||
+     buf[0] || buf[1] || buf[2] || buf[3]){
+    printf("%s: hole is not zero\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("hugesparse");
+}
+
+// mmap: file pages fault in on first touch, MAP_SHARED stores
+// reach other mappers at once and the file at munmap,
+// MAP_PRIVATE ones do not, and anonymous memory starts out zero.
+void
+mmaptest(char *s)
+{
+  int fd, i, pid, xstatus, fds[2];
+  char *p, *q, buf[16];
+
+  unlink("mmapf");
+  fd = open("mmapf", O_CREATE|O_RDWR);
+  for(i = 0; i < 2*4096; i += sizeof(buf)){
+    memset(buf, 'a' + (i/4096), sizeof(buf));
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+
+  p = mmap(0, 2*4096, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  q = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 4096);
+  if(p == (char*)-1 || q == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  if(p[0] != 'a' || p[4096] != 'b' || q[10] != 'b'){
+    printf("%s: mapped data wrong\n", s);
+    exit(1);
+  }
+  p[1] = 'X';
+  q[0] = 'Y';
+
+  // the child gets its own copy of the touched pages.
+  pid = fork();
+  if(pid == 0){
+    if(p[1] != 'X' || q[0] != 'Y')
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong mapped data\n", s);
+    exit(1);
+  }
+
+  // a process that maps the file on its own shares the pages:
+  // each sees the other's stores while both still map them.
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid == 0){
+    int cfd = open("mmapf", O_RDWR);
+    char *c = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED, cfd, 0);
+    if(c == (char*)-1)
+      exit(1);
+    c[20] = 'C';
+    write(fds[1], "x", 1);
+    for(i = 0; i < 100 && c[21] != 'P'; i++)
+      sleep(1);
+    exit(c[21] != 'P');
+  }
+  close(fds[1]);
+  if(read(fds[0], buf, 1) != 1 || p[20] != 'C'){
+    printf("%s: store by another mapper not seen\n", s);
+    exit(1);
+  }
+  p[21] = 'P';
+  wait(&xstatus);
+  close(fds[0]);
+  if(xstatus != 0){
+    printf("%s: other mapper did not see store\n", s);
+    exit(1);
+  }
+
+  // read() into a shared page that is still mapped read-only.
+  if(pread(fd, p + 4096 + 100, 4, 0) != 4 || p[4096 + 101] != 'X'){
+    printf("%s: read into mapping failed\n", s);
+    exit(1);
+  }
+
+  // read() and write() of a file to and from untouched pages
+  // mapped from that same file.
+  char *r = mmap(0, 2*4096, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(r == (char*)-1 || pread(fd, r, 16, 4096) != 16 || r[0] != 'b' ||
+     pwrite(fd, r + 4096, 1, 2) != 1 || pread(fd, buf, 1, 2) != 1 || buf[0] != 'b'){
+    printf("%s: read or write with own mapping failed\n", s);
+    exit(1);
+  }
+  munmap(r, 2*4096);
+  if(munmap(p, 2*4096) < 0 || munmap(q, 4096) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, 2, 0) != 2 || buf[1] != 'X' ||
+     pread(fd, buf, 1, 4096) != 1 || buf[0] != 'b'){
+    printf("%s: file does not match shared mapping\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmapf");
+
+  p = mmap(0, 3*4096, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(p == (char*)-1 || p[5000] != 0){
+    printf("%s: anonymous mmap failed\n", s);
+    exit(1);
+  }
+  p[5000] = 1;
+  if(munmap(p, 3*4096) < 0){
+    printf("%s: anonymous munmap failed\n", s);
+    exit(1);
+  }
+
+  // MAP_SHARED anonymous memory is shared with children,
+  // including pages nobody touched before the fork.
+  p = mmap(0, 2*4096, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if(p == (char*)-1){
+    printf("%s: shared anonymous mmap failed\n", s);
+    exit(1);
+  }
+  p[0] = 1;
+  pid = fork();
+  if(pid == 0){
+    p[0] = 2;
+    p[4096] = 3;
+    exit(0);
+  }
+  wait(0);
+  if(p[0] != 2 || p[4096] != 3){
+    printf("%s: child store not seen in shared mapping\n", s);
+    exit(1);
+  }
+  munmap(p, 2*4096);
+}
+
+// sbrk() only reserves address space; pages appear, zeroed,
+// when the program or the kernel on its behalf first uses them.
+void
+lazysbrk(char *s)
+{
+  uint64 big = 1024*1024*1024;
+  int fds[2], pid, xstatus;
+  char *a, buf[8];
+
+  a = sbrk(big);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk of 1GB failed\n", s);
+    exit(1);
+  }
+  a[0] = 1;
+  a[big/2] = 2;
+  a[big-1] = 3;
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], a + big/4, sizeof(buf)) != sizeof(buf) ||
+     read(fds[0], a + 3*big/4, sizeof(buf)) != sizeof(buf)){
+    printf("%s: read/write of untouched pages failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  memset(buf, 0, sizeof(buf));
+  if(memcmp(a + 3*big/4, buf, sizeof(buf)) != 0){
+    printf("%s: untouched page not zero\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid == 0){
+    if(a[0] != 1 || a[big/2] != 2 || a[big-1] != 3 || a[big/8] != 0)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong heap\n", s);
+    exit(1);
+  }
+
+  if(sbrk(-big) != a + big){
+    printf("%s: sbrk shrink failed\n", s);
+    exit(1);
+  }
+}
+
+// vmsplice() hands pages to a pipe by reference, splice()
+// moves file data into one, and a page-aligned read() takes
+// whole pages back; neither side may see the other's stores.
+void
+splicetest(char *s)
+{
+  int fd, fds[2], i, n, pid, xstatus;
+  char *a, *b;
+
+  a = sbrk(0);
+  sbrk(4096 - (uint64)a % 4096);
+  a = sbrk(4*4096);
+  b = a + 2*4096;
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+
+  for(i = 0; i < 2*4096; i++)
+    a[i] = i % 251;
+  if(vmsplice(fds[1], a, 2*4096) != 2*4096){
+    printf("%s: vmsplice failed\n", s);
+    exit(1);
+  }
+  a[0] = a[4096] = 'x';
+  if(read(fds[0], b, 2*4096) != 2*4096){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 2*4096; i++)
+    if(b[i] != i % 251){
+      printf("%s: vmsplice data wrong at %d\n", s, i);
+      exit(1);
+    }
+  b[1] = 'y';
+  if(a[0] != 'x' || a[1] != 1){
+    printf("%s: sender saw receiver's store\n", s);
+    exit(1);
+  }
+
+  unlink("splicef");
+  fd = open("splicef", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, a, 2*4096) != 2*4096 || write(fd, a, 100) != 100){
+    printf("%s: file write failed\n", s);
+    exit(1);
+  }
+  seek(fd, 0, SEEK_SET);
+  pid = fork();
+  if(pid == 0){
+    close(fds[0]);
+    while((n = splice(fd, fds[1], 3000)) > 0)
+      ;
+    exit(n);
+  }
+  close(fds[1]);
+  for(i = 0; (n = read(fds[0], b, 2*4096 - i % 4096)) > 0; i += n){
+    for(int j = 0; j < n; j++)
+      if(b[j] != a[(i + j) % (2*4096)]){
+        printf("%s: spliced data wrong at %d\n", s, i + j);
+        exit(1);
+      }
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || i != 2*4096 + 100){
+    printf("%s: splice moved %d bytes\n", s, i);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fd);
+  unlink("splicef");
+}
+
+// a child killed by a bad store makes the kernel log a
+// message naming it, which dmesg() must return, and a short
+// buffer gets the newest bytes of the log.
+void
+dmesgtest(char *s)
+{
+  static char buf[64*1024];
+  char *p, *q;
+  int i, n, pid, xstatus;
+
+  pid = fork();
+  if(pid == 0){
+    *(volatile char*)0x3000000000L = 1;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: bad store did not kill child\n", s);
+    exit(1);
+  }
+
+  if((n = dmesg(buf, sizeof(buf))) <= 0 || n > sizeof(buf)){
+    printf("%s: dmesg returned %d\n", s, n);
+    exit(1);
+  }
+  for(p = buf; p < buf + n - 4; p++){
+    if(memcmp(p, "pid=", 4) != 0)
+      continue;
+    for(i = 0, q = p + 4; q < buf + n && *q >= '0' && *q <= '9'; q++)
+      i = i*10 + *q - '0';
+    if(i == pid)
+      break;
+  }
+  if(p >= buf + n - 4){
+    printf("%s: no log message for pid %d\n", s, pid);
+    exit(1);
+  }
+
+  if(dmesg(buf, 16) > 16){
+    printf("%s: dmesg overran its buffer\n", s);
+    exit(1);
+  }
+  if(dmesg((char*)0x3000000000L, 16) != -1){
+    printf("%s: dmesg to a bad address succeeded\n", s);
+    exit(1);
+  }
+}
+
+// a read from a pipe set non-blocking returns -1 rather than
+// wait for data, and the console's mode can be read and set.
+void
+nonblocktest(char *s)
+{
+  int fds[2], fd, mode;
+  char buf[8];
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(ioctl(fds[0], FIONBIO, 1) != 0){
+    printf("%s: FIONBIO failed\n", s);
+    exit(1);
+  }
+  if(read(fds[0], buf, sizeof(buf)) != -1){
+    printf("%s: read of empty pipe did not fail\n", s);
+    exit(1);
+  }
+  if(write(fds[1], "abc", 3) != 3 || read(fds[0], buf, sizeof(buf)) != 3){
+    printf("%s: pipe transfer failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  if(read(fds[0], buf, sizeof(buf)) != 0){
+    printf("%s: no end-of-file\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+
+  if((fd = open("console", O_RDWR|O_NONBLOCK)) < 0){
+    printf("%s: open console failed\n", s);
+    exit(1);
+  }
+  mode = ioctl(fd, CONSGETMODE, 0);
+  if(ioctl(fd, CONSSETMODE, CONS_NOECHO) != 0 || ioctl(fd, CONSGETMODE, 0) != CONS_NOECHO){
+    printf("%s: console mode not set\n", s);
+    exit(1);
+  }
+  if(ioctl(fd, CONSSETMODE, 0x100) != -1){
+    printf("%s: bad console mode accepted\n", s);
+    exit(1);
+  }
+  ioctl(fd, CONSSETMODE, mode);
+  close(fd);
+}
+
+// fork shares memory copy-on-write: a child of a process
+// using half of physical memory must still fit, and stores
+// by either side, including ones the kernel makes for read(),
+// must not be seen by the other.
+void
+cowtest(char *s)
+{
+  int i, n, pid, fds[2], xstatus;
+  uint64 sz = 64*1024*1024;
+  char *p;
+
+  p = sbrk(sz);
+  if(p == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < sz; i += 4096)
+    *(int*)(p + i) = i;
+
+  for(n = 0; n < 3; n++){
+    if(pipe(fds) < 0){
+      printf("%s: pipe failed\n", s);
+      exit(1);
+    }
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[1]);
+      for(i = 0; i < sz; i += 4096)
+        if(*(int*)(p + i) != i)
+          exit(1);
+      for(i = 0; i < sz; i += 16*4096)
+        *(int*)(p + i) = -1;
+      if(read(fds[0], p + 4096 + 8, 4) != 4 || *(int*)(p + 4096 + 8) != n)
+        exit(1);
+      for(i = 0; i < sz; i += 16*4096)
+        if(*(int*)(p + i) != -1)
+          exit(1);
+      exit(0);
+    }
+    close(fds[0]);
+    if(write(fds[1], &n, 4) != 4){
+      printf("%s: pipe write failed\n", s);
+      exit(1);
+    }
+    close(fds[1]);
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("%s: child saw wrong memory\n", s);
+      exit(1);
+    }
+  }
+
+  for(i = 0; i < sz; i += 4096)
+    if(*(int*)(p + i) != i || p[4096 + 8] != 0){
+      printf("%s: child store seen by parent\n", s);
+      exit(1);
+    }
+  sbrk(-sz);
+}
+
 void
 exectest(char *s)
 {
@@ -1918,12 +2574,13 @@ dirfile(char *s)
 
 // test that iput() is called at the end of _namei().
 // also tests empty file names.
+#define NIREF 51
 void
 iref(char *s)
 {
   int i, fd;
 
-  for(i = 0; i < NINODE + 1; i++){
+  for(i = 0; i < NIREF; i++){
     if(mkdir("irefd") != 0){
       printf("%s: mkdir irefd failed\n", s);
       exit(1);
@@ -1945,7 +2602,7 @@ iref(char *s)
   }
 
   // clean up
-  for(i = 0; i < NINODE + 1; i++){
+  for(i = 0; i < NIREF; i++){
     chdir("..");
     unlink("irefd");
   }
@@ -2592,6 +3249,17 @@ struct test {
   {writebig, "writebig"},
   {createtest, "createtest"},
   {dirtest, "dirtest"},
+  {dcachetest, "dcache"},
+  {hashdirtest, "hashdir"},
+  {preadwrite, "preadwrite"},
+  {sparse, "sparse"},
+  {hugesparse, "hugesparse"},
+  {mmaptest, "mmap"},
+  {cowtest, "cow"},
+  {splicetest, "splice"},
+  {dmesgtest, "dmesg"},
+  {nonblocktest, "nonblock"},
+  {lazysbrk, "lazysbrk"},
   {exectest, "exectest"},
   {pipe1, "pipe1"},
   {killstatus, "killstatus"},
@@ -2924,6 +3592,120 @@ outofinodes(char *s)
   }
 }
 
+// how long fork+exec takes for a process with a few
+// megabytes of memory, as the shell does for each command.
+void
+forkexec(char *s)
+{
+  int i, n = 200, t0, t1;
+  uint64 sz = 4*1024*1024;
+  char *p;
+
+  p = sbrk(sz);
+  if(p == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < sz; i += 4096)
+    p[i] = 1;
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(1);
+      char *args[] = { "echo", 0 };
+      exec("echo", args);
+      exit(1);
+    }
+    wait(0);
+  }
+  t1 = uptime();
+  printf("%d fork+exec with %d KB in %d ticks ", n, (int)(sz/1024), t1 - t0);
+  sbrk(-sz);
+}
+
+// how fast bytes go through a pipe between two processes.
+void
+pipethroughput(char *s)
+{
+  enum { MB = 16, CHUNK = 8192 };
+  static char buf[CHUNK];
+  int fds[2], pid, i, n, total, t0, t1;
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(i = 0; i < MB*1024*1024 / CHUNK; i++){
+      if(write(fds[1], buf, CHUNK) != CHUNK){
+        printf("%s: write failed\n", s);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  t0 = uptime();
+  total = 0;
+  while((n = read(fds[0], buf, CHUNK)) > 0)
+    total += n;
+  t1 = uptime();
+  close(fds[0]);
+  wait(0);
+  if(total != MB*1024*1024){
+    printf("%s: read %d bytes\n", s, total);
+    exit(1);
+  }
+  printf("%d MB in %d ticks ", MB, t1 - t0);
+}
+
+// time system calls that copy a few bytes at a time to and
+// from user memory: one-byte pipe transfers and fstat().
+void
+smallcopy(char *s)
+{
+  enum { N = 100000 };
+  struct stat st;
+  int fds[2], i, t0, t1, t2;
+  char c = 'x';
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  t0 = uptime();
+  for(i = 0; i < N; i++){
+    if(write(fds[1], &c, 1) != 1 || read(fds[0], &c, 1) != 1){
+      printf("%s: pipe transfer failed\n", s);
+      exit(1);
+    }
+  }
+  t1 = uptime();
+  for(i = 0; i < N; i++){
+    if(fstat(fds[0], &st) < 0){
+      printf("%s: fstat failed\n", s);
+      exit(1);
+    }
+  }
+  t2 = uptime();
+  close(fds[0]);
+  close(fds[1]);
+  printf("%d pipe round trips in %d ticks, %d fstats in %d ticks ",
+         N, t1 - t0, N, t2 - t1);
+}
+
 struct test slowtests[] = {
   {bigdir, "bigdir"},
   {manywrites, "manywrites"},
@@ -2931,6 +3713,9 @@ struct test slowtests[] = {
   {execout, "execout"},
   {diskfull, "diskfull"},
   {outofinodes, "outofinodes"},
+  {forkexec, "forkexec"},
+  {pipethroughput, "pipethroughput"},
+  {smallcopy, "smallcopy"},
     
   { 0, 0},
 };
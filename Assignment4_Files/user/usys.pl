@@ -37,3 +37,14 @@ entry("sbrk");
 entry("sleep");
 entry("uptime");
 entry("seek");
+entry("pread");
+entry("pwrite");
+entry("readv");
+entry("writev");
+entry("fallocate");
+entry("mmap");
+entry("munmap");
+entry("vmsplice");
+entry("splice");
+entry("dmesg");
+entry("ioctl");
@@ -2,7 +2,8 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 
-char buf[512];
+// a whole aligned page, so that a pipe can hand its pages over.
+char buf[4096] __attribute__((aligned(4096)));
 
 void
 wc(int fd, char *name)